@@ -0,0 +1,120 @@
+#!/bin/sh
+#
+# bench.sh
+# Scheduler throughput benchmark for simOS.
+#
+# Runs every scheduling algorithm at each CPU count on generated workloads
+# (simOS -w) of each size, without the Gantt chart and without sleeping
+# between ticks, and collects simulated ticks/sec, scheduler decisions
+# (context switches)/sec and peak RSS from the final statistics.  Results go
+# to bench/results.txt and are compared against bench/baseline.txt; a
+# throughput drop or memory growth beyond BENCH_TOLERANCE percent is
+# reported as a regression and makes the script exit non-zero.  The
+# baseline is local to the machine: the first run records it.
+#
+# Usually run through "make bench" / "make bench-baseline".  Environment:
+#   BENCH_BIN       simulator binary to measure     default ./simOS
+#                   (e.g. ./simOS-pgo, see the Makefile's build profiles)
+#   BENCH_SIZES     workload sizes (# processes)    default 100 to 1000000
+#   BENCH_WORKLOAD  settings added to the -w spec   default short processes
+#                   (see workgen.h)                 arriving 10 per tick
+#   BENCH_CPUS      CPU counts                      default "1 2 4 8 16"
+#   BENCH_ALGS      algorithms: fifo rr prio mlf    default all
+#                   edf lottery stride gang
+#   BENCH_SLICE     time slice where one is needed  default 3
+#   BENCH_ARRIVAL   arrival process (simOS -a)      default the workload's
+#   BENCH_REPEAT    runs of each configuration,     default 3
+#                   the fastest is kept
+#   BENCH_TIMEOUT   seconds allowed per run         default 300
+#   BENCH_TOLERANCE allowed regression in percent   default 50
+#                   (runs on one machine vary by up to ~40%)
+#   BENCH_RECORD    if set, save the results as the new baseline
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+bin=${BENCH_BIN:-./simOS}
+sizes=${BENCH_SIZES:-"100 1000 10000 100000 1000000"}
+workload=${BENCH_WORKLOAD:-"bursts=fixed:2,ccpu=exp:2,arrival=fixed:0.1"}
+cpus=${BENCH_CPUS:-"1 2 4 8 16"}
+algs=${BENCH_ALGS:-"fifo rr prio mlf edf lottery stride gang"}
+slice=${BENCH_SLICE:-3}
+limit=${BENCH_TIMEOUT:-300}
+repeat=${BENCH_REPEAT:-3}
+tolerance=${BENCH_TOLERANCE:-50}
+arrival=${BENCH_ARRIVAL:+-a $BENCH_ARRIVAL}
+results=bench/results.txt
+baseline=bench/baseline.txt
+
+printf "%-7s %5s %8s %14s %14s %10s %9s\n" "#alg" "cpus" "procs" \
+    "ticks/s" "decisions/s" "rss_kb" "wall_s" > $results
+
+for n in $sizes; do
+    for c in $cpus; do
+        for a in $algs; do
+            case $a in
+                fifo) flags="" ;;
+                rr)   flags="-r $slice" ;;
+                prio) flags="-p" ;;
+                mlf)  flags="-m $slice" ;;
+                edf)  flags="-e" ;;
+                lottery) flags="-l $slice" ;;
+                stride)  flags="-s $slice" ;;
+                gang) flags="-g $slice" ;;
+                *)    echo "unknown algorithm $a" >&2; exit 1 ;;
+            esac
+            # the small runs are short, so keep the fastest of a few
+            best=""
+            r=0
+            while [ $r -lt $repeat ]; do
+                r=$((r + 1))
+                out=$(timeout $limit $bin $c $flags \
+                    -w n=$n,seed=1,$workload $arrival -q -t 0)
+                if [ $? -ne 0 ]; then
+                    best=failed
+                    break
+                fi
+                best=$(echo "$out" | awk -v best="$best" '
+                    /^Simulated ticks per second/     { tps = $NF }
+                    /^Scheduler decisions per second/ { dps = $NF }
+                    /^Peak RSS/                       { rss = $(NF-1) }
+                    /^Wall clock time/                { wall = $(NF-1) }
+                    END { split(best, b, " ")
+                          if (best != "" && b[1] >= tps) print best
+                          else print tps, dps, rss, wall }')
+            done
+            if [ "$best" = failed ]; then
+                printf "%-7s %5s %8s %14s %14s %10s %9s\n" $a $c $n \
+                    failed - - - | tee -a $results
+                continue
+            fi
+            echo "$best" | awk -v a=$a -v c=$c -v n=$n '
+                { printf "%-7s %5s %8s %14s %14s %10s %9s\n",
+                  a, c, n, $1, $2, $3, $4 }' | tee -a $results
+        done
+    done
+done
+
+if [ -n "$BENCH_RECORD" ] || [ ! -f $baseline ]; then
+    cp $results $baseline
+    echo "recorded $baseline"
+    exit 0
+fi
+
+# compare each result against the baseline row for the same configuration
+awk -v tol=$tolerance '
+    FNR == NR { if ($1 !~ /^#/) { tps[$1" "$2" "$3] = $4; rss[$1" "$2" "$3] = $6 }; next }
+    $1 ~ /^#/ { next }
+    {
+        key = $1" "$2" "$3
+        if (!(key in tps)) next
+        if ($4 == "failed") { print "REGRESSION " key ": run failed"; bad = 1; next }
+        if ($4 < tps[key] * (100 - tol) / 100) {
+            printf "REGRESSION %s: %s ticks/s, baseline %s\n", key, $4, tps[key]; bad = 1
+        }
+        if ($6 > rss[key] * (100 + tol) / 100) {
+            printf "REGRESSION %s: %s KB peak RSS, baseline %s\n", key, $6, rss[key]; bad = 1
+        }
+    }
+    END { if (!bad) print "no regressions against baseline"; exit bad }
+' $baseline $results
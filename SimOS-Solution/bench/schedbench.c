@@ -0,0 +1,405 @@
+/*
+ * schedbench.c
+ * Multithreaded OS Simulation
+ *
+ * Micro-benchmarks of the scheduler's primitives, without the simulator:
+ * sched.c is compiled into this program with its main() renamed, and the
+ * simulator functions it calls are replaced by stubs below, so nothing
+ * sleeps, no CPU threads run and no context switch happens.
+ *
+ * For every algorithm and queue depth d a child process sets the scheduler
+ * up as simOS would (through sched.c's main(), with a generated workload of
+ * d processes plus one running process per CPU) and measures, in ns/op:
+ *
+ *   enqueue     addReadyProcess(), filling the queue from empty to d
+ *   pick        getReadyProcess(), draining it from d to empty
+ *               (small queues are filled and drained repeatedly, for at
+ *               least ops/10 operations, and each pass is timed)
+ *   idle        should_idle() with d processes ready
+ *   cycle       a pick and an enqueue, keeping d processes ready
+ *   preempt     the preemption decision wake_up() makes after queueing a
+ *               process, preempt_for(), with d processes ready and every
+ *               CPU busy (only prio and edf preempt)
+ *
+ * With -t, cycle is also measured with that many threads picking and
+ * enqueueing at once on their own CPUs; it is then the wall time divided
+ * by the operations of all threads, so it shows what contention on
+ * ready_mutex costs.
+ *
+ * Usage: bench/schedbench [-a algs] [-d depths] [-t threads] [-c cpus]
+ *                         [-n ops]
+ *   -a  comma separated fifo,rr,prio,mlf,edf,lottery,stride,gang
+ *       (all of them; gang runs single-threaded processes)
+ *   -d  comma separated queue depths          (1,10,100,1000,10000,100000,
+ *                                              1000000)
+ *   -t  comma separated thread counts for the contended cycle        (1)
+ *   -c  CPUs, i.e. how many running processes wake_up() looks at     (4)
+ *   -n  operations timed for idle, cycle and preempt            (1000000)
+ *
+ * Usually run through "make microbench".
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define main sched_main
+#include "../sched.c"
+#undef main
+
+typedef struct {
+    const char *name;
+    const char *flags;          /* simOS options selecting it */
+    const char *workload;       /* added to the -w spec */
+} bench_alg_t;
+
+static const bench_alg_t bench_algs[] = {
+    { "fifo", NULL, "" },
+    { "rr", "-r", "" },
+    { "prio", "-p", "" },
+    { "mlf", "-m", "" },
+    { "edf", "-e", ",rt=0.5" },
+    { "lottery", "-l", "" },
+    { "stride", "-s", "" },
+    { "gang", "-g", "" },
+};
+
+#define BENCH_ALGS (sizeof(bench_algs) / sizeof(bench_algs[0]))
+
+static unsigned long ops = 1000000;
+static unsigned int bench_cpus = 4;
+static volatile int sink;       /* keeps should_idle() calls from going away */
+
+
+/* Stubs for the simulator (simOS.c) */
+
+extern void start_simulator(unsigned int new_cpu_count,
+                            const sim_config_t *new_config)
+{
+}
+
+extern unsigned int context_switch(unsigned int cpu_id, pcb_t *pcb,
+                                   int preemption_time)
+{
+    return 0;
+}
+
+/* the preemption happens at once, so the next wake_up() may preempt again */
+extern void force_preempt(unsigned int cpu_id)
+{
+    preempting[cpu_id] = 0;
+}
+
+extern domain_level_t cpu_distance(unsigned int cpu_a, unsigned int cpu_b)
+{
+    return cpu_a == cpu_b ? DOMAIN_CPU : DOMAIN_LLC;
+}
+
+extern unsigned int cpu_speed(unsigned int cpu_id)
+{
+    return 100;
+}
+
+extern unsigned int cpu_run_ticks(unsigned int cpu_id)
+{
+    return 1;
+}
+
+extern unsigned int get_simulator_time(void)
+{
+    return 0;
+}
+
+extern int parse_topology(const char *spec, sim_topology_t *topology)
+{
+    return -1;
+}
+
+extern int parse_power(const char *spec, sim_power_t *power)
+{
+    return -1;
+}
+
+extern void mt_safe_usleep(unsigned long usec)
+{
+}
+
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* queue a process that isn't queued, as an I/O completion would */
+static void make_ready(pcb_t *proc)
+{
+    proc->state = PROCESS_READY;
+    addReadyProcess(proc);
+}
+
+/* the processes queued by the benchmark are the first depth of the table */
+static void fill(unsigned int depth)
+{
+    unsigned int i;
+
+    for (i=0; i<depth; i++)
+    {
+        if (alg == MultiLevelFeedback)
+            process_table[i].temp_priority = mlf_levels - 1;
+        make_ready(&process_table[i]);
+    }
+}
+
+static void drain(void)
+{
+    while (getReadyProcess(0) != NULL)
+        ;
+}
+
+static void cycle(unsigned int cpu_id, unsigned long count)
+{
+    unsigned long i;
+
+    for (i=0; i<count; i++)
+    {
+        pcb_t *proc = getReadyProcess(cpu_id);
+
+        if (proc != NULL)
+            make_ready(proc);
+    }
+}
+
+typedef struct {
+    pthread_t thread;
+    unsigned int cpu_id;
+    unsigned long count;
+} bench_thread_t;
+
+static pthread_barrier_t start_line;
+
+static void *cycle_thread(void *data)
+{
+    bench_thread_t *t = data;
+
+    pthread_barrier_wait(&start_line);
+    cycle(t->cpu_id, t->count);
+    return NULL;
+}
+
+/* contended cycles, ns per operation of all threads together */
+static double contended_cycle(unsigned int threads)
+{
+    bench_thread_t *t = malloc(sizeof(bench_thread_t) * threads);
+    double start;
+    unsigned int i;
+
+    assert(t != NULL);
+    pthread_barrier_init(&start_line, NULL, threads + 1);
+    for (i=0; i<threads; i++)
+    {
+        t[i].cpu_id = i;
+        t[i].count = ops / threads;
+        pthread_create(&t[i].thread, NULL, cycle_thread, &t[i]);
+    }
+    start = now_ns();
+    pthread_barrier_wait(&start_line);
+    for (i=0; i<threads; i++)
+        pthread_join(t[i].thread, NULL);
+    free(t);
+    return (now_ns() - start) / (ops / threads * threads);
+}
+
+/*
+ * run() measures one algorithm at one depth, in a child process as the
+ * scheduler can only be set up once, and prints a line of results.
+ */
+static void run(const bench_alg_t *a, unsigned int depth,
+                const unsigned int *threads, int thread_counts)
+{
+    char cpus[16], spec[64];
+    char *argv[8];
+    int argc = 0, out, i;
+    unsigned int c;
+    unsigned long rounds = ops / 10 / depth + 1, r;
+    double start, enqueue, pick, idle, plain, preempt;
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid != 0)
+    {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    /* the running processes come after the depth ready ones */
+    c = bench_cpus;
+    for (i=0; i<thread_counts; i++)
+        if (threads[i] > c)
+            c = threads[i];
+    snprintf(cpus, sizeof(cpus), "%u", c);
+    snprintf(spec, sizeof(spec), "n=%u,seed=1%s", depth + c, a->workload);
+    argv[argc++] = "schedbench";
+    argv[argc++] = cpus;
+    if (a->flags != NULL)
+        argv[argc++] = (char *)a->flags;
+    if (a->flags != NULL && strcmp(a->flags, "-p") != 0 &&
+        strcmp(a->flags, "-e") != 0)
+        argv[argc++] = "3";
+    argv[argc++] = "-w";
+    argv[argc++] = spec;
+    argv[argc] = NULL;
+
+    /* sched.c's main() announces the run on stdout */
+    out = dup(STDOUT_FILENO);
+    freopen("/dev/null", "w", stdout);
+    optind = 1;
+    if (sched_main(argc, argv) != 0)
+        exit(-1);
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+
+    for (c=0; c<(unsigned int)cpu_count; c++)
+    {
+        current[c] = &process_table[depth + c];
+        current[c]->state = PROCESS_RUNNING;
+    }
+
+    enqueue = pick = 0.0;
+    for (r=0; r<rounds; r++)
+    {
+        start = now_ns();
+        fill(depth);
+        enqueue += now_ns() - start;
+        start = now_ns();
+        drain();
+        pick += now_ns() - start;
+    }
+    enqueue /= (double)rounds * depth;
+    pick /= (double)rounds * depth;
+
+    fill(depth);
+    start = now_ns();
+    for (i=0; (unsigned long)i<ops; i++)
+        sink = should_idle(0);
+    idle = (now_ns() - start) / ops;
+
+    start = now_ns();
+    cycle(0, ops);
+    plain = (now_ns() - start) / ops;
+
+    /* the ready processes in turn, as if each had just been queued */
+    start = now_ns();
+    for (i=0; (unsigned long)i<ops; i++)
+        preempt_for(&process_table[i % depth]);
+    preempt = (now_ns() - start) / ops;
+    drain();
+
+    printf("%-8s %8u %8.1f %8.1f %8.1f %8.1f %8.1f", a->name, depth, enqueue,
+           pick, idle, plain, preempt);
+    for (i=0; i<thread_counts; i++)
+    {
+        fill(depth);
+        printf(" %8.1f", contended_cycle(threads[i]));
+        drain();
+    }
+    printf("\n");
+    exit(0);
+}
+
+/* parse_numbers() reads a comma separated list into numbers, returns how many */
+static int parse_numbers(const char *text, unsigned int *numbers, int max)
+{
+    int count = 0;
+    char *end;
+
+    while (count < max)
+    {
+        numbers[count] = strtoul(text, &end, 10);
+        if (end == text || numbers[count] == 0)
+            return -1;
+        count++;
+        if (*end == '\0')
+            return count;
+        if (*end != ',')
+            return -1;
+        text = end + 1;
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned int depths[32] = { 1, 10, 100, 1000, 10000, 100000,
+                                       1000000 };
+    static unsigned int threads[32] = { 1 };
+    int depth_count = 7, thread_counts = 1, opt, i, j;
+    const char *algs = NULL;
+    size_t k;
+
+    while ((opt = getopt(argc, argv, "a:d:t:c:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            algs = optarg;
+            break;
+        case 'd':
+            depth_count = parse_numbers(optarg, depths, 32);
+            break;
+        case 't':
+            thread_counts = parse_numbers(optarg, threads, 32);
+            break;
+        case 'c':
+            bench_cpus = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            ops = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            depth_count = -1;
+        }
+    }
+    if (depth_count < 0 || thread_counts < 0 || bench_cpus == 0 || ops == 0 ||
+        optind != argc)
+    {
+        fprintf(stderr, "Usage: %s [-a algs] [-d depths] [-t threads] "
+                "[-c cpus] [-n ops]\n", argv[0]);
+        return -1;
+    }
+
+    printf("# ns/op, %lu ops, %u CPUs\n", ops, bench_cpus);
+    printf("%-8s %8s %8s %8s %8s %8s %8s", "#alg", "depth", "enqueue",
+           "pick", "idle", "cycle", "preempt");
+    for (i=0; i<thread_counts; i++)
+    {
+        char heading[16];
+
+        snprintf(heading, sizeof(heading), "cycle/%u", threads[i]);
+        printf(" %8s", heading);
+    }
+    printf("\n");
+
+    for (k=0; k<BENCH_ALGS; k++)
+    {
+        if (algs != NULL)
+        {
+            const char *found = strstr(algs, bench_algs[k].name);
+            size_t length = strlen(bench_algs[k].name);
+
+            if (found == NULL || (found != algs && found[-1] != ',') ||
+                (found[length] != '\0' && found[length] != ','))
+                continue;
+        }
+        for (j=0; j<depth_count; j++)
+            run(&bench_algs[k], depths[j], threads, thread_counts);
+    }
+    return 0;
+}
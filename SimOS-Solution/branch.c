@@ -0,0 +1,254 @@
+/*
+ * branch.c
+ * Multithreaded OS Simulation
+ *
+ * Branching a run - see branch.h.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "branch.h"
+
+#define BRANCH_MAX 16
+#define BRANCH_MAX_WORDS 32
+
+typedef struct {
+    const char *options;        /* as given, to head its column */
+    char *words[BRANCH_MAX_WORDS];
+    int word_count;
+    pid_t pid;
+    FILE *output;               /* the child's stdout */
+    int failed;
+} branch_t;
+
+static branch_t branches[BRANCH_MAX];
+static int branches_added = 0;
+
+/*
+ * the command line, without the options that end or start a run early, and
+ * --metrics, which is the parent's
+ */
+static char **command = NULL;
+static int command_length = 0;
+
+static const char *const dropped[] = { "--branch", "--checkpoint", "--restore",
+                                       "--metrics" };
+
+#define DROPPED (sizeof(dropped) / sizeof(dropped[0]))
+
+/*
+ * One line of the results table: a statistic ("label: value" in the final
+ * statistics) and its value in each branch, NULL where a branch has none.
+ */
+typedef struct {
+    char *label;
+    char *values[BRANCH_MAX];
+} branch_row_t;
+
+static branch_row_t *rows = NULL;
+static int row_count = 0, row_space = 0;
+
+extern void branch_command(int argc, char *argv[])
+{
+    int i;
+    size_t k;
+
+    command = malloc(sizeof(char*) * (argc + 1));
+    assert(command != NULL);
+    command[command_length++] = argv[0];
+    for (i=1; i<argc; i++)
+    {
+        for (k=0; k<DROPPED; k++)
+        {
+            size_t length = strlen(dropped[k]);
+
+            if (strncmp(argv[i], dropped[k], length) == 0 &&
+                (argv[i][length] == '\0' || argv[i][length] == '='))
+                break;
+        }
+        if (k == DROPPED)
+            command[command_length++] = argv[i];
+        else if (strchr(argv[i], '=') == NULL)
+            i++;                /* and its argument */
+    }
+    command[command_length] = NULL;
+}
+
+extern int branch_add(const char *options)
+{
+    branch_t *b;
+    char *words, *word;
+
+    if (branches_added == BRANCH_MAX)
+        return -1;
+    b = &branches[branches_added];
+    b->options = options[0] != '\0' ? options : "(unchanged)";
+    b->word_count = 0;
+    words = strdup(options);
+    assert(words != NULL);
+    for (word = strtok(words, " \t"); word != NULL; word = strtok(NULL, " \t"))
+    {
+        if (b->word_count == BRANCH_MAX_WORDS)
+            return -1;
+        b->words[b->word_count++] = word;
+    }
+    branches_added++;
+    return 0;
+}
+
+extern int branch_count(void)
+{
+    return branches_added;
+}
+
+/* start a branch's child, running from the checkpoint at restore */
+static void start_branch(branch_t *b, char *restore)
+{
+    char **args = malloc(sizeof(char*) * (command_length + b->word_count + 4));
+    int n = 0, k;
+
+    assert(args != NULL);
+    for (k=0; k<command_length; k++)
+        args[n++] = command[k];
+    args[n++] = "-q";
+    for (k=0; k<b->word_count; k++)
+        args[n++] = b->words[k];
+    args[n++] = "--restore";
+    args[n++] = restore;
+    args[n] = NULL;
+
+    b->output = tmpfile();
+    if (b->output == NULL)
+    {
+        perror("branch output");
+        exit(-1);
+    }
+    b->pid = fork();
+    if (b->pid < 0)
+    {
+        perror("fork");
+        exit(-1);
+    }
+    if (b->pid == 0)
+    {
+        /* only async-signal-safe calls between fork() and exec() */
+        dup2(fileno(b->output), STDOUT_FILENO);
+        execvp(args[0], args);
+        _exit(127);
+    }
+    free(args);
+}
+
+/* the row for label, added at the end if there isn't one */
+static branch_row_t *find_row(const char *label)
+{
+    int i;
+
+    for (i=0; i<row_count; i++)
+        if (strcmp(rows[i].label, label) == 0)
+            return &rows[i];
+    if (row_count == row_space)
+    {
+        row_space = row_space > 0 ? row_space * 2 : 32;
+        rows = realloc(rows, sizeof(branch_row_t) * row_space);
+        assert(rows != NULL);
+    }
+    memset(&rows[row_count], 0, sizeof(branch_row_t));
+    rows[row_count].label = strdup(label);
+    assert(rows[row_count].label != NULL);
+    return &rows[row_count++];
+}
+
+/*
+ * read_results() adds the "label: value" lines of a branch's output to the
+ * table.  Indented lines belong to multi-line tables (histograms, shares),
+ * which don't fit in a column and are left out.
+ */
+static void read_results(int branch)
+{
+    FILE *output = branches[branch].output;
+    char *line = NULL, *colon;
+    size_t space = 0;
+    ssize_t length;
+
+    rewind(output);
+    while ((length = getline(&line, &space, output)) > 0)
+    {
+        if (line[length - 1] == '\n')
+            line[length - 1] = '\0';
+        colon = strstr(line, ": ");
+        if (colon == NULL || line[0] == ' ')
+            continue;
+        *colon = '\0';
+        find_row(line)->values[branch] = strdup(colon + 2);
+    }
+    free(line);
+    fclose(output);
+}
+
+/* print_results() prints the table, one column per branch */
+static void print_results(unsigned int tick)
+{
+    int width[BRANCH_MAX], label_width = 0, i, j;
+
+    for (j=0; j<branches_added; j++)
+        width[j] = branches[j].failed ? 8 : (int)strlen(branches[j].options);
+    width[branches_added - 1] = 0;      /* no padding after the last column */
+    for (i=0; i<row_count; i++)
+    {
+        if ((int)strlen(rows[i].label) > label_width)
+            label_width = strlen(rows[i].label);
+        for (j=0; j<branches_added; j++)
+            if (rows[i].values[j] != NULL && j < branches_added - 1 &&
+                (int)strlen(rows[i].values[j]) > width[j])
+                width[j] = strlen(rows[i].values[j]);
+    }
+
+    printf("\nBranches from tick %u:\n%-*s", tick, label_width, "");
+    for (j=0; j<branches_added; j++)
+        printf("  %-*s", width[j],
+               branches[j].failed ? "(failed)" : branches[j].options);
+    printf("\n");
+    for (i=0; i<row_count; i++)
+    {
+        printf("%-*s", label_width, rows[i].label);
+        for (j=0; j<branches_added; j++)
+            printf("  %-*s", width[j],
+                   rows[i].values[j] != NULL ? rows[i].values[j] : "-");
+        printf("\n");
+    }
+}
+
+extern int branch_run(FILE *checkpoint, unsigned int tick)
+{
+    char restore[32];
+    int failed = 0, status, j;
+
+    snprintf(restore, sizeof(restore), "/dev/fd/%d", fileno(checkpoint));
+    fflush(stdout);
+    for (j=0; j<branches_added; j++)
+        start_branch(&branches[j], restore);
+
+    for (j=0; j<branches_added; j++)
+    {
+        branch_t *b = &branches[j];
+
+        b->failed = waitpid(b->pid, &status, 0) < 0 || !WIFEXITED(status) ||
+                    WEXITSTATUS(status) != 0;
+        if (b->failed)
+        {
+            fprintf(stderr, "branch \"%s\" failed\n", b->options);
+            failed++;
+            fclose(b->output);
+        }
+        else
+            read_results(j);
+    }
+    print_results(tick);
+    return failed;
+}
@@ -0,0 +1,45 @@
+/*
+ * branch.h
+ * Multithreaded OS Simulation
+ *
+ * Branching a run (--branch): at a given tick the run is checkpointed (see
+ * checkpoint.h) into an unlinked temporary file, and continued from there
+ * by one child process per branch, each with its own options added to the
+ * command line, e.g. another algorithm or time slice.  The children run at
+ * the same time and quietly, and once they have all finished their final
+ * statistics are printed side by side.  The warm-up before the branch
+ * point is only simulated once, however many branches there are.
+ *
+ * A child can't simply carry on from fork(): the CPU threads don't survive
+ * it, and the scheduler's queues are set up for one algorithm at start-up.
+ * So each child runs this program again, with the original command line
+ * (without --branch, --checkpoint, --restore and --metrics), "-q", the
+ * branch's options and "--restore" of the checkpoint as /dev/fd/<n>.  On
+ * Linux each child opening /dev/fd/<n> gets its own file offset.
+ */
+
+#ifndef __BRANCH_H__
+#define __BRANCH_H__
+
+#include <stdio.h>
+
+/* remember the command line, before getopt_long() reorders it */
+extern void branch_command(int argc, char *argv[]);
+
+/*
+ * branch_add() adds a branch with options, a space separated list of
+ * command line options such as "-m 3 --mlf-boost 100".  Returns 0, or -1
+ * if there are too many options.
+ */
+extern int branch_add(const char *options);
+
+extern int branch_count(void);
+
+/*
+ * branch_run() runs every branch from checkpoint, saved at tick, waits for
+ * them and prints their results.  Returns the number of branches that
+ * failed.
+ */
+extern int branch_run(FILE *checkpoint, unsigned int tick);
+
+#endif /* __BRANCH_H__ */
@@ -0,0 +1,175 @@
+/*
+ * checkpoint.c
+ * Multithreaded OS Simulation
+ *
+ * Checkpoint files - see checkpoint.h.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "SIMOSCKP"
+#define CHECKPOINT_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t long_size;         /* the statistics are mostly longs */
+} checkpoint_header_t;
+
+/* the file being written or read, for messages */
+static const char *checkpoint_path = NULL;
+
+extern void checkpoint_fail(const char *message)
+{
+    fprintf(stderr, "%s: %s\n", checkpoint_path, message);
+    exit(-1);
+}
+
+static void write_header(FILE *file)
+{
+    checkpoint_header_t header = { .version = CHECKPOINT_VERSION,
+                                   .long_size = sizeof(long) };
+
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    checkpoint_write(file, &header, sizeof(header));
+}
+
+extern FILE *checkpoint_create(const char *path)
+{
+    FILE *file;
+
+    checkpoint_path = path;
+    file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(-1);
+    }
+    write_header(file);
+    return file;
+}
+
+extern FILE *checkpoint_create_temp(void)
+{
+    FILE *file;
+
+    checkpoint_path = "branch checkpoint";
+    file = tmpfile();
+    if (file == NULL)
+    {
+        perror(checkpoint_path);
+        exit(-1);
+    }
+    write_header(file);
+    return file;
+}
+
+extern FILE *checkpoint_open(const char *path)
+{
+    checkpoint_header_t header;
+    FILE *file;
+
+    checkpoint_path = path;
+    file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(-1);
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)
+        checkpoint_fail("not a checkpoint");
+    if (header.version != CHECKPOINT_VERSION ||
+        header.long_size != sizeof(long))
+        checkpoint_fail("checkpoint from a different version or machine");
+    return file;
+}
+
+extern void checkpoint_flush(FILE *file)
+{
+    if (ferror(file) || fflush(file) != 0)
+        checkpoint_fail("error writing checkpoint");
+}
+
+extern void checkpoint_close(FILE *file)
+{
+    if (ferror(file) || fclose(file) != 0)
+        checkpoint_fail("error writing checkpoint");
+}
+
+extern void checkpoint_section(FILE *file, const char *tag)
+{
+    checkpoint_write(file, tag, 4);
+}
+
+extern void checkpoint_expect(FILE *file, const char *tag)
+{
+    char found[4];
+
+    checkpoint_read(file, found, 4);
+    if (memcmp(found, tag, 4) != 0)
+        checkpoint_fail("corrupt checkpoint");
+}
+
+extern void checkpoint_write(FILE *file, const void *data, size_t size)
+{
+    if (size > 0 && fwrite(data, size, 1, file) != 1)
+        checkpoint_fail("error writing checkpoint");
+}
+
+extern void checkpoint_read(FILE *file, void *data, size_t size)
+{
+    if (size > 0 && fread(data, size, 1, file) != 1)
+        checkpoint_fail(feof(file) ? "checkpoint is truncated" :
+                        "error reading checkpoint");
+}
+
+extern void checkpoint_write_array(FILE *file, const void *array, size_t size)
+{
+    uint64_t saved = array != NULL ? size : 0;
+
+    checkpoint_write(file, &saved, sizeof(saved));
+    if (array != NULL)
+        checkpoint_write(file, array, size);
+}
+
+extern int checkpoint_read_array(FILE *file, void *array, size_t size)
+{
+    uint64_t saved;
+
+    checkpoint_read(file, &saved, sizeof(saved));
+    if (saved == 0)
+        return 0;
+    if (array == NULL)
+    {
+        if (fseek(file, (long)saved, SEEK_CUR) != 0)
+            checkpoint_fail("checkpoint is truncated");
+        return 0;
+    }
+    if (saved != size)
+        checkpoint_fail("checkpoint doesn't match this run");
+    checkpoint_read(file, array, size);
+    return 1;
+}
+
+extern void checkpoint_write_vars(FILE *file, const checkpoint_var_t *vars,
+                                  size_t count)
+{
+    size_t i;
+
+    for (i=0; i<count; i++)
+        checkpoint_write(file, vars[i].data, vars[i].size);
+}
+
+extern void checkpoint_read_vars(FILE *file, const checkpoint_var_t *vars,
+                                 size_t count)
+{
+    size_t i;
+
+    for (i=0; i<count; i++)
+        checkpoint_read(file, vars[i].data, vars[i].size);
+}
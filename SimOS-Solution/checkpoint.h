@@ -0,0 +1,82 @@
+/*
+ * checkpoint.h
+ * Multithreaded OS Simulation
+ *
+ * Checkpoint files.  A checkpoint is the whole state of a run at the start
+ * of a tick - the simulator's (simOS.c) and the scheduler's (sched.c) - so
+ * the run can be stopped there and continued later, e.g. to simulate the
+ * warm-up of a long workload once and start several experiments from where
+ * it ended.
+ *
+ * The workload itself isn't saved: the run that restores a checkpoint has
+ * to load the same workload on the same number of CPUs, and each process is
+ * brought back to where it was by taking the ops it had already taken
+ * again.  The scheduler's part is independent of the algorithm (which
+ * processes are running, the ready processes in the order they were queued
+ * and the per-process bookkeeping), so a checkpoint may be continued under
+ * another scheduler.
+ *
+ * The file is a header and tagged sections of raw binary data, so it can
+ * only be restored by a build for the same kind of machine.  Any error in
+ * writing or reading one prints a message naming the file and exits.
+ */
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* open a checkpoint for writing, and write its header */
+extern FILE *checkpoint_create(const char *path);
+
+/* open a checkpoint in an unlinked temporary file, for branching a run */
+extern FILE *checkpoint_create_temp(void);
+
+/* open a checkpoint for reading, checking its header */
+extern FILE *checkpoint_open(const char *path);
+
+/*
+ * checkpoint_flush() checks that everything was written, leaving the file
+ * open; checkpoint_close() checks and closes it.
+ */
+extern void checkpoint_flush(FILE *file);
+extern void checkpoint_close(FILE *file);
+
+/*
+ * checkpoint_section() writes the tag starting a section, and
+ * checkpoint_expect() reads one and checks it is tag, so a reader that gets
+ * out of step notices at the next section.  Tags are 4 characters.
+ */
+extern void checkpoint_section(FILE *file, const char *tag);
+extern void checkpoint_expect(FILE *file, const char *tag);
+
+/* checkpoint_fail() reports a checkpoint that makes no sense, and exits */
+extern void checkpoint_fail(const char *message);
+
+extern void checkpoint_write(FILE *file, const void *data, size_t size);
+extern void checkpoint_read(FILE *file, void *data, size_t size);
+
+/*
+ * checkpoint_write_array() saves an array that may not have been allocated
+ * (NULL).  checkpoint_read_array() reads it back into array, if both the
+ * saved array and array exist, and returns whether it did; otherwise the
+ * saved data is skipped and array left for the caller to set up.
+ */
+extern void checkpoint_write_array(FILE *file, const void *array, size_t size);
+extern int checkpoint_read_array(FILE *file, void *array, size_t size);
+
+/* a list of variables saved and restored as they are */
+typedef struct {
+    void *data;
+    size_t size;
+} checkpoint_var_t;
+
+#define CHECKPOINT_VAR(v) { &(v), sizeof(v) }
+
+extern void checkpoint_write_vars(FILE *file, const checkpoint_var_t *vars,
+                                  size_t count);
+extern void checkpoint_read_vars(FILE *file, const checkpoint_var_t *vars,
+                                 size_t count);
+
+#endif /* __CHECKPOINT_H__ */
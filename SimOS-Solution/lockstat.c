@@ -0,0 +1,116 @@
+/*
+ * lockstat.c
+ * Optional lock instrumentation - see lockstat.h.
+ *
+ * Times are taken with clock_gettime(CLOCK_MONOTONIC).  An acquisition is
+ * counted as contended when an initial trylock fails; only contended
+ * acquisitions accumulate wait time.
+ */
+
+#include "lockstat.h"
+
+#ifdef LOCK_STATS
+
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+// all registered locks, in registration order
+static lock_stats_t *registered_head = NULL;
+static lock_stats_t *registered_tail = NULL;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+extern void lock_stats_register(lock_stats_t *stats, const char *name)
+{
+    stats->name = name;
+    stats->next = NULL;
+    if (registered_tail == NULL)
+        registered_head = stats;
+    else
+        registered_tail->next = stats;
+    registered_tail = stats;
+}
+
+extern void lock_stats_mutex_lock(pthread_mutex_t *mutex, lock_stats_t *stats)
+{
+    uint64_t wait = 0;
+
+    if (pthread_mutex_trylock(mutex) == EBUSY)
+    {
+        uint64_t start = now_ns();
+        pthread_mutex_lock(mutex);
+        wait = now_ns() - start;
+        stats->contended++;
+    }
+
+    /* we own the lock from here on, safe to update the stats */
+    stats->acquisitions++;
+    stats->wait_ns += wait;
+    if (wait > stats->max_wait_ns)
+        stats->max_wait_ns = wait;
+    stats->acquired_at = now_ns();
+}
+
+/* close the current hold interval, must be called with the lock held */
+static void end_hold(lock_stats_t *stats)
+{
+    uint64_t hold = now_ns() - stats->acquired_at;
+
+    stats->hold_ns += hold;
+    if (hold > stats->max_hold_ns)
+        stats->max_hold_ns = hold;
+}
+
+extern void lock_stats_mutex_unlock(pthread_mutex_t *mutex, lock_stats_t *stats)
+{
+    end_hold(stats);
+    pthread_mutex_unlock(mutex);
+}
+
+extern void lock_stats_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                                 lock_stats_t *stats)
+{
+    end_hold(stats);
+    pthread_cond_wait(cond, mutex);
+    stats->acquired_at = now_ns();
+}
+
+extern void lock_stats_cond_block(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                                  lock_stats_t *stats)
+{
+    uint64_t start, wait;
+
+    end_hold(stats);
+    start = now_ns();
+    pthread_cond_wait(cond, mutex);
+    wait = now_ns() - start;
+
+    stats->contended++;
+    stats->wait_ns += wait;
+    if (wait > stats->max_wait_ns)
+        stats->max_wait_ns = wait;
+    stats->acquired_at = now_ns();
+}
+
+extern void lock_stats_report(void)
+{
+    lock_stats_t *s;
+
+    printf("\nLock statistics:\n");
+    printf("%-20s %12s %12s %12s %12s %12s %12s\n", "lock", "acquired",
+           "contended", "wait ms", "max wait us", "hold ms", "max hold us");
+    for (s = registered_head; s != NULL; s = s->next)
+    {
+        printf("%-20s %12lu %12lu %12.3f %12.1f %12.3f %12.1f\n", s->name,
+               s->acquisitions, s->contended, s->wait_ns / 1e6,
+               s->max_wait_ns / 1e3, s->hold_ns / 1e6, s->max_hold_ns / 1e3);
+    }
+}
+
+#endif /* LOCK_STATS */
@@ -0,0 +1,76 @@
+/*
+ * lockstat.h
+ * Optional lock instrumentation for the simulator and scheduler.
+ *
+ * Build with "make LOCK_STATS=1" to record, for each instrumented mutex,
+ * the number of acquisitions, how many of them were contended, and the
+ * total / maximum time spent waiting for and holding the lock.  A per-lock
+ * report is printed with the final statistics.
+ *
+ * Without LOCK_STATS the STAT_* macros compile down to the plain pthread
+ * calls, so the instrumentation costs nothing in normal builds.
+ */
+
+#ifndef __LOCKSTAT_H__
+#define __LOCKSTAT_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Statistics for one lock.  All fields except name and next are only
+ * updated while the lock itself is held, so they need no extra protection.
+ */
+typedef struct _lock_stats_t {
+    const char *name;
+    unsigned long acquisitions;
+    unsigned long contended;
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t hold_ns;
+    uint64_t max_hold_ns;
+    uint64_t acquired_at;
+    struct _lock_stats_t *next;
+} lock_stats_t;
+
+#ifdef LOCK_STATS
+
+/* register a lock so it shows up in lock_stats_report() - call before use */
+extern void lock_stats_register(lock_stats_t *stats, const char *name);
+
+extern void lock_stats_mutex_lock(pthread_mutex_t *mutex, lock_stats_t *stats);
+extern void lock_stats_mutex_unlock(pthread_mutex_t *mutex, lock_stats_t *stats);
+
+/*
+ * Condition waits release the mutex, so the hold interval is closed before
+ * waiting and restarted afterwards.  lock_stats_cond_wait() does not count
+ * the time asleep as lock wait (e.g. idle() waiting for work);
+ * lock_stats_cond_block() does, for waits that really are lock contention
+ * (e.g. the IRWL reader waiting for writers to drain).
+ */
+extern void lock_stats_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                                 lock_stats_t *stats);
+extern void lock_stats_cond_block(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                                  lock_stats_t *stats);
+
+/* print one line per registered lock */
+extern void lock_stats_report(void);
+
+#define STAT_LOCK(m, s) lock_stats_mutex_lock((m), (s))
+#define STAT_UNLOCK(m, s) lock_stats_mutex_unlock((m), (s))
+#define STAT_COND_WAIT(c, m, s) lock_stats_cond_wait((c), (m), (s))
+#define STAT_COND_BLOCK(c, m, s) lock_stats_cond_block((c), (m), (s))
+
+#else
+
+#define lock_stats_register(s, n) ((void)(s), (void)(n))
+#define lock_stats_report() ((void)0)
+
+#define STAT_LOCK(m, s) ((void)(s), pthread_mutex_lock(m))
+#define STAT_UNLOCK(m, s) ((void)(s), pthread_mutex_unlock(m))
+#define STAT_COND_WAIT(c, m, s) ((void)(s), pthread_cond_wait((c), (m)))
+#define STAT_COND_BLOCK(c, m, s) ((void)(s), pthread_cond_wait((c), (m)))
+
+#endif /* LOCK_STATS */
+
+#endif /* __LOCKSTAT_H__ */
@@ -0,0 +1,156 @@
+/*
+ * metrics.c
+ * Multithreaded OS Simulation
+ *
+ * Live metrics in shared memory - see metrics.h.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "metrics.h"
+
+/* the simulator's object, to mark finished and unlink at exit */
+static sim_metrics_t *published = NULL;
+static char *published_name = NULL;
+
+/* shm_open() wants a name starting with a slash */
+static char *object_name(const char *name)
+{
+    char *full = malloc(strlen(name) + 2);
+
+    if (full == NULL)
+        return NULL;
+    full[0] = '/';
+    strcpy(full + (name[0] == '/' ? 0 : 1), name);
+    return full;
+}
+
+static void metrics_exit(void)
+{
+    metrics_begin(published);
+    published->finished = 1;
+    metrics_end(published);
+    shm_unlink(published_name);
+}
+
+/* a run interrupted by a signal unlinks the object too, then dies of it */
+static void metrics_signal(int sig)
+{
+    shm_unlink(published_name);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/* catch sig with metrics_signal(), unless it is ignored */
+static void unlink_on(int sig)
+{
+    struct sigaction action, old;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = metrics_signal;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(sig, NULL, &old) == 0 && old.sa_handler == SIG_DFL)
+        sigaction(sig, &action, NULL);
+}
+
+extern sim_metrics_t *metrics_create(const char *name)
+{
+    char *full = object_name(name);
+    sim_metrics_t *metrics;
+    int fd;
+
+    fd = full != NULL ? shm_open(full, O_CREAT | O_EXCL | O_RDWR, 0644) : -1;
+    if (fd < 0 && full != NULL && errno == EEXIST)
+    {
+        fprintf(stderr, "%s: replacing an existing metrics object (left by "
+                "a run that was killed, or in use by another)\n", name);
+        fd = shm_open(full, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    }
+    if (fd < 0 || ftruncate(fd, sizeof(sim_metrics_t)) != 0)
+    {
+        perror(name);
+        exit(-1);
+    }
+    metrics = mmap(NULL, sizeof(sim_metrics_t), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    close(fd);
+    if (metrics == MAP_FAILED)
+    {
+        perror(name);
+        exit(-1);
+    }
+
+    memcpy(metrics->magic, METRICS_MAGIC, sizeof(metrics->magic));
+    metrics->version = METRICS_VERSION;
+    metrics->pid = getpid();
+    published = metrics;
+    published_name = full;
+    atexit(metrics_exit);
+    unlink_on(SIGINT);
+    unlink_on(SIGTERM);
+    unlink_on(SIGHUP);
+    return metrics;
+}
+
+extern void metrics_begin(sim_metrics_t *metrics)
+{
+    __atomic_store_n(&metrics->seq, metrics->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+extern void metrics_end(sim_metrics_t *metrics)
+{
+    __atomic_store_n(&metrics->seq, metrics->seq + 1, __ATOMIC_RELEASE);
+}
+
+extern const sim_metrics_t *metrics_attach(const char *name)
+{
+    char *full = object_name(name);
+    const sim_metrics_t *metrics;
+    int fd;
+
+    fd = full != NULL ? shm_open(full, O_RDONLY, 0) : -1;
+    free(full);
+    if (fd < 0)
+    {
+        perror(name);
+        return NULL;
+    }
+    metrics = mmap(NULL, sizeof(sim_metrics_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (metrics == MAP_FAILED)
+    {
+        perror(name);
+        return NULL;
+    }
+    if (memcmp(metrics->magic, METRICS_MAGIC, sizeof(metrics->magic)) != 0 ||
+        metrics->version != METRICS_VERSION)
+    {
+        fprintf(stderr, "%s: not the metrics of this version of simOS\n",
+                name);
+        munmap((void *)metrics, sizeof(sim_metrics_t));
+        return NULL;
+    }
+    return metrics;
+}
+
+extern void metrics_snapshot(const sim_metrics_t *metrics,
+                             sim_metrics_t *copy)
+{
+    uint32_t before, after;
+
+    do
+    {
+        before = __atomic_load_n(&metrics->seq, __ATOMIC_ACQUIRE);
+        memcpy(copy, metrics, sizeof(sim_metrics_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&metrics->seq, __ATOMIC_RELAXED);
+    } while (before != after || (before & 1) != 0);
+}
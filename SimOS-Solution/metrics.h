@@ -0,0 +1,82 @@
+/*
+ * metrics.h
+ * Multithreaded OS Simulation
+ *
+ * Live metrics (--metrics name): the simulator publishes its progress in a
+ * POSIX shared memory object, /name, which simtop (simtop.c) or any other
+ * local program can map and read while the run goes on.
+ *
+ * The simulator's supervisor updates it at most METRICS_INTERVAL_MS apart,
+ * at the end of a tick, and once more when the run ends.  Readers take no
+ * lock: seq is a sequence count that is odd while an update is being
+ * written, and metrics_snapshot() copies the whole segment again until it
+ * gets a copy with the same even count before and after.  The object is
+ * unlinked when the simulator exits, after setting finished, so a reader
+ * that has it mapped still sees the final numbers.  A run ended by SIGINT,
+ * SIGTERM or SIGHUP unlinks it without setting finished; only one that is
+ * killed outright (SIGKILL, a crash) leaves it behind, and the next run
+ * with that name reports and replaces it.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+
+#include "simOS.h"
+
+#define METRICS_MAGIC "SIMOSMET"
+#define METRICS_VERSION 1
+#define METRICS_INTERVAL_MS 100
+#define METRICS_MAX_LEVELS 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t seq;
+    int32_t pid;                /* of the simulator */
+    uint32_t finished;          /* the run has ended */
+    uint32_t cpu_count;
+    uint32_t process_count;
+
+    uint64_t simulator_time;
+    uint64_t wall_ns;           /* real time since the run started */
+    double ticks_per_sec;       /* since the previous update */
+
+    /* processes by state; every waiting process is in the I/O queue */
+    uint32_t created, running, ready, waiting, terminated;
+    uint64_t context_switches;
+
+    /*
+     * Ready processes in each of the scheduler's queues, lowest priority
+     * first: the MLF levels, the static priorities (0-10) or a single one.
+     */
+    uint32_t levels;
+    uint32_t level_depth[METRICS_MAX_LEVELS];
+
+    /* ticks each CPU has spent running a process */
+    uint64_t cpu_busy[SIM_MAX_CPUS];
+} sim_metrics_t;
+
+/*
+ * metrics_create() creates the object /name for the simulator and maps it,
+ * exiting with a message if it can't.  An object that already exists is
+ * replaced, with a warning.
+ */
+extern sim_metrics_t *metrics_create(const char *name);
+
+/* metrics_begin() and metrics_end() bracket every update of the metrics */
+extern void metrics_begin(sim_metrics_t *metrics);
+extern void metrics_end(sim_metrics_t *metrics);
+
+/*
+ * metrics_attach() maps /name for reading, or returns NULL after printing
+ * a message if there is no such object or it isn't a simulator's.
+ */
+extern const sim_metrics_t *metrics_attach(const char *name);
+
+/* metrics_snapshot() copies a consistent set of metrics into copy */
+extern void metrics_snapshot(const sim_metrics_t *metrics,
+                             sim_metrics_t *copy);
+
+#endif /* __METRICS_H__ */
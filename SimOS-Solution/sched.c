@@ -8,18 +8,48 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
 
 #include "simOS.h"
 #include "sched.h"
+#include "lockstat.h"
+#include "workload.h"
+#include "workgen.h"
+#include "checkpoint.h"
+#include "branch.h"
 
 // Local helper functions
 static void schedule(unsigned int cpu_id);
 static void addReadyProcess(pcb_t* proc); 
-static pcb_t* getReadyProcess(void); 
+static void enqueue(pcb_t* proc);
+static void addToList(pcb_t* proc);
+static pcb_t* getReadyProcess(unsigned int cpu_id); 
+static int affinity_score(pcb_t* proc, unsigned int cpu_id);
+static int pick_score(pcb_t* proc, unsigned int cpu_id);
+static unsigned int* parse_list(const char* text, unsigned int count);
+static int mlf_level(pcb_t* proc);
+static void mlf_boost(void);
+static int best_level(void);
+static int active_cpus(void);
+static void rt_release(pcb_t* proc);
+static unsigned int charge_cpu(unsigned int cpu_id);
+static void stride_charge(pcb_t* proc, unsigned int used);
+static void rt_complete(pcb_t* proc);
+static int more_urgent(pcb_t* a, pcb_t* b);
+static void heap_push(pcb_t* proc);
+static pcb_t* heap_pop(void);
+static void tree_add(unsigned int index, long tickets);
+static pcb_t* tree_draw(void);
+static void gang_account(void);
+static int gang_fits(pcb_t* proc, unsigned int cpu_id);
+static pcb_t* gang_pick(unsigned int cpu_id);
+static void gang_exit(pcb_t* proc);
 
 /*
  * possible scheduling algorithms
@@ -28,7 +58,11 @@ typedef enum {
     FIFO = 0,
     RoundRobin,
     StaticPriority,
-    MultiLevelFeedback
+    MultiLevelFeedback,
+    EarliestDeadline,
+    Lottery,
+    Stride,
+    Gang
 } scheduler_alg;
 
 scheduler_alg alg;
@@ -37,70 +71,654 @@ scheduler_alg alg;
 int time_slice = -1;
 int cpu_count;
 
-// Queues for multi-level feedback
-pcb_t* multi_level_heads[4] = {NULL};
-pcb_t* multi_level_tails[4] = {NULL};
+/*
+ * Queues for multi-level feedback, level mlf_levels-1 is the highest
+ * priority.  Bit i of level_nonempty is set while queue i has processes, so
+ * the highest non-empty level is found without scanning, and
+ * level_count[i] is how many processes it holds (for --metrics).  A
+ * process at level i runs for mlf_quantum[i] ticks before it is preempted.
+ * Static priority uses the same queues, one per priority (0-10).
+ */
+#define MLF_MAX_LEVELS 64
+int mlf_levels = 4;
+unsigned int* mlf_quantum = NULL;
+pcb_t* multi_level_heads[MLF_MAX_LEVELS] = {NULL};
+pcb_t* multi_level_tails[MLF_MAX_LEVELS] = {NULL};
+uint64_t level_nonempty = 0;
+unsigned int level_count[MLF_MAX_LEVELS];
+
+/*
+ * Priority boost (--mlf-boost): every mlf_boost_interval ticks all
+ * processes go back to the top level, so CPU-bound processes that sank to
+ * the bottom can't starve.  Boosts are applied lazily: the queued
+ * processes are moved up by splicing the lower queues onto the top one
+ * the next time the queues are used, and every other process gets its
+ * level reset the next time it is looked at, when its mlf_epoch[] is older
+ * than the current boost epoch.
+ */
+unsigned int mlf_boost_interval = 0;
+unsigned int mlf_boosted_epoch = 0;
+unsigned int* mlf_epoch = NULL;
+
+/*
+ * Aging for static priority (--aging step): a ready process's effective
+ * priority is its static priority plus one for every step ticks it has
+ * been waiting, so low priority processes can't be passed over forever.
+ * Each priority queue is in order of arrival, so its head has waited
+ * longest, and only the heads need comparing to find the best process.
+ * ready_since[] (by process_index()) is when each process was last queued;
+ * max_ready_wait[] is the longest wait seen per static priority.  Both are
+ * protected by ready_mutex.
+ */
+unsigned int aging_step = 0;
+unsigned int* ready_since = NULL;
+unsigned int max_ready_wait[11];
+
+/*
+ * preempting[cpu] is set (under current_mutex) when wake_up asks for a CPU
+ * to be preempted, and cleared when schedule picks its next process.
+ */
+int* preempting = NULL;
+
+/*
+ * Affinity-aware picking (--affinity): instead of strictly taking the first
+ * process in a queue, look at the first AFFINITY_WINDOW processes and take
+ * the one that is cheapest to run on this CPU.  The window bounds both the
+ * cost of the scan and how far a process can be overtaken.
+ */
+#define AFFINITY_WINDOW 8
+int affinity = 0;
+
+/*
+ * big.LITTLE placement (--placement): the same bounded search, steering
+ * CPU-bound processes (names starting with C) to the faster CPUs and
+ * I/O-bound ones (names starting with I) to the slower ones.
+ */
+int placement = 0;
+unsigned int mean_speed = 100;
+
+/*
+ * Energy-aware consolidation (--energy-aware n): keep work on as few CPUs as
+ * the load needs so the rest can drop into deep idle.  CPU 0 always runs,
+ * CPU k only picks up work while at least k*n processes are ready.
+ * ready_count is protected by ready_mutex.
+ */
+int energy_threshold = 0;
+unsigned int ready_count = 0;
+
+/*
+ * Real-time accounting.  Each CPU burst of a process with a period or
+ * deadline is a job: it is released when the process wakes up, but no
+ * sooner than one period after the previous job's release, must be done
+ * by release + deadline, and is done when the process starts I/O or
+ * terminates.  Kept for every algorithm so they can be compared, and
+ * indexed by process_index().  A job's release, deadline and seq are set
+ * under ready_mutex, as the EDF heap is ordered by them; its demand, and the
+ * statistics below, are kept under current_mutex while the process runs.
+ */
+#define NO_DEADLINE UINT_MAX
+#define LATENESS_BUCKETS 12
+
+typedef struct {
+  unsigned int release;     // when the current job was released
+  unsigned int deadline;    // its absolute deadline, or NO_DEADLINE
+  unsigned int demand;      // CPU time it has had so far
+  unsigned int max_demand;  // the process's longest job so far
+  unsigned long seq;        // when it was last queued, breaks deadline ties
+} rt_job_t;
+
+rt_job_t* jobs = NULL;
+unsigned int rt_processes = 0;
+unsigned long jobs_done = 0, jobs_missed = 0, total_lateness = 0;
+unsigned int max_lateness = 0;
+unsigned long queue_seq = 0;
+// lateness_hist[0] = on time, [k] = late by 2^(k-1) to 2^k - 1 ticks
+unsigned long lateness_hist[LATENESS_BUCKETS];
+
+/*
+ * EDF and stride ready queue: binary min-heap of processes ordered by job
+ * deadline or pass value (see heap_before()), protected by ready_mutex.
+ */
+pcb_t** ready_heap = NULL;
+unsigned int heap_size = 0;
+
+/*
+ * Proportional share: a process holds static_priority + 1 tickets.
+ *
+ * Lottery draws one of the ready processes' tickets at random each time a
+ * CPU needs a process.  ticket_tree[] is a Fenwick tree over
+ * process_index() holding the tickets of the ready processes, so a draw,
+ * adding and removing a process all take O(log n).
+ *
+ * Stride gives each process a pass value which goes up by STRIDE1/tickets
+ * for every time slice of CPU time it uses (and in proportion for less,
+ * when it leaves the CPU early), and runs the ready process with the lowest
+ * pass, from ready_heap.  A process joining the queue starts no lower than
+ * the last pass dispatched, so it can't catch up on time it spent asleep.
+ *
+ * Both are protected by ready_mutex.  cpu_ticks[] is the CPU time each
+ * priority has had, as the simulator counted it (cpu_run_ticks()), and
+ * share_ticks[] a copy taken when the first priority runs out of processes,
+ * while all of them were still competing.  These and live_processes[] are
+ * protected by current_mutex.
+ */
+#define STRIDE1 (1 << 20)
+#define tickets(proc) ((proc)->static_priority + 1)
+
+long* ticket_tree = NULL;
+unsigned long total_tickets = 0;
+unsigned int tree_top = 1;
+uint64_t lottery_rng = 0x9e3779b97f4a7c15ull;
+uint64_t* stride_pass = NULL;
+uint64_t global_pass = 0;
+unsigned long cpu_ticks[11];
+unsigned long share_ticks[11];
+unsigned int share_time = 0;
+unsigned int live_processes[11];
+
+/*
+ * Gang scheduling (-g slice): the threads of a group (see pcb_t) are
+ * dispatched together, one per CPU, or not at all.  A thread that becomes
+ * ready waits in its gang_t until all of the group's threads are ready; the
+ * last of them is then queued in the FIFO queue for the whole gang.  The CPU
+ * that takes it off the queue hands the other threads to idle CPUs through
+ * gang_assigned[].  While the head of the queue is a gang with more threads
+ * than there are idle CPUs, CPUs stay idle until enough are free (nothing
+ * behind it may jump ahead), so idle CPU time while processes are ready is
+ * what fragmentation costs.  When one thread's slice ends the gang's other
+ * running threads are preempted too.
+ *
+ * All of it is protected by ready_mutex.  cpu_idle[] is which CPUs the
+ * scheduler has left idle, and idle_ticks/fragment_ticks are integrated
+ * lazily by gang_account() whenever the idle CPUs or the queue change.
+ */
+typedef struct {
+  unsigned int size;      // threads that haven't terminated
+  unsigned int ready;     // threads waiting for the rest of the gang
+  unsigned int count;     // all its threads, in members
+  pcb_t** members;
+} gang_t;
+
+gang_t* gangs = NULL;     // indexed by group number
+unsigned int max_group = 0;
+pcb_t** gang_assigned = NULL;
+int* cpu_idle = NULL;
+unsigned int idle_cpus = 0;
+unsigned int gang_accounted_at = 0;
+unsigned long gangs_dispatched = 0, gang_threads = 0;
+unsigned long idle_ticks = 0, fragment_ticks = 0;
+
+/*
+ * CPUs in schedule(), or that have left idle() with a process to pick up
+ * and haven't got there yet, so sched_settled() can tell a checkpoint to
+ * wait for them (schedule() still records the dispatch after its
+ * context_switch()).  Updated atomically, as schedule() runs without
+ * ready_mutex.
+ */
+int dispatching = 0;
+
+// instrumentation for the scheduler's locks (only active with LOCK_STATS)
+static lock_stats_t ready_mutex_stats;
+static lock_stats_t current_mutex_stats;
+
+/* long options, for the less common settings */
+enum {
+    OPT_SWITCH_COST = 256,
+    OPT_MIGRATION_COST,
+    OPT_TOPOLOGY,
+    OPT_AFFINITY,
+    OPT_CPU_SPEEDS,
+    OPT_PLACEMENT,
+    OPT_POWER,
+    OPT_ENERGY_AWARE,
+    OPT_MLF_LEVELS,
+    OPT_MLF_QUANTA,
+    OPT_MLF_BOOST,
+    OPT_AGING,
+    OPT_CHECKPOINT,
+    OPT_RESTORE,
+    OPT_BRANCH,
+    OPT_METRICS
+};
+
+static const struct option long_options[] = {
+    { "switch-cost", required_argument, NULL, OPT_SWITCH_COST },
+    { "migration-cost", required_argument, NULL, OPT_MIGRATION_COST },
+    { "topology", required_argument, NULL, OPT_TOPOLOGY },
+    { "affinity", no_argument, NULL, OPT_AFFINITY },
+    { "cpu-speeds", required_argument, NULL, OPT_CPU_SPEEDS },
+    { "placement", no_argument, NULL, OPT_PLACEMENT },
+    { "power", optional_argument, NULL, OPT_POWER },
+    { "energy-aware", required_argument, NULL, OPT_ENERGY_AWARE },
+    { "mlf-levels", required_argument, NULL, OPT_MLF_LEVELS },
+    { "mlf-quanta", required_argument, NULL, OPT_MLF_QUANTA },
+    { "mlf-boost", required_argument, NULL, OPT_MLF_BOOST },
+    { "aging", required_argument, NULL, OPT_AGING },
+    { "checkpoint", required_argument, NULL, OPT_CHECKPOINT },
+    { "restore", required_argument, NULL, OPT_RESTORE },
+    { "branch", required_argument, NULL, OPT_BRANCH },
+    { "metrics", required_argument, NULL, OPT_METRICS },
+    { NULL, 0, NULL, 0 }
+};
+
+/*
+ * usage() prints the command line options to stderr
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: ./simOS <# CPUs> [ -r <time slice> | -m <time slice> | -p ] [options]\n"
+        "    Default : FIFO Scheduler\n"
+        "         -r : Round-Robin Scheduler (must also give time slice)\n"
+        "         -m : Multi-Level Feedback Scheduler (must also give time slice)\n"
+        "         -p : Static Priority Scheduler\n"
+        "         -e : Earliest Deadline First Scheduler (see pcb_t for deadlines)\n"
+        "         -l : Lottery Scheduler (must also give time slice)\n"
+        "         -s : Stride Scheduler (must also give time slice)\n"
+        "         -g : Gang Scheduler for multi-threaded processes (must also\n"
+        "              give time slice)\n"
+        "  Options:\n"
+        "    -n <count> : run <count> copies of the standard processes\n"
+        "    -w <spec>  : run a generated workload, e.g. n=1000,seed=3,mix=0.4\n"
+        "                 (see workgen.h for all settings)\n"
+        "    -f <file>  : run the processes in a workload file (see workload.h)\n"
+        "    -a <arr>   : arrival process, e.g. poisson:0.5, burst:100:50,\n"
+        "                 diurnal:0.2:5000[,seed=7] (see workgen.h)\n"
+        "    -q         : quiet, no Gantt chart (final stats only)\n"
+        "    -t <usec>  : real time between simulated ticks (default 10, 0 = no sleep)\n"
+        "    --switch-cost <ticks>    : CPU time lost on every context switch\n"
+        "    --migration-cost <ticks> : extra time lost when a process moves CPUs\n"
+        "    --topology <spec>        : cache/NUMA layout and per-level migration\n"
+        "                               costs, e.g. llc=4,node=2,socket=2,cost=1:4:8:16\n"
+        "    --affinity               : prefer ready processes that last ran on this\n"
+        "                               CPU, then ones from the same cache domain\n"
+        "    --cpu-speeds <list>      : relative CPU speeds in percent, e.g. 200x2,100x6\n"
+        "                               (the last one repeats for remaining CPUs)\n"
+        "    --placement              : run CPU-bound (C*) processes on fast CPUs and\n"
+        "                               I/O-bound (I*) ones on slow CPUs when possible\n"
+        "    --power[=<spec>]         : account energy, optionally with a power model\n"
+        "                               e.g. active=10,idle=3,deep=0.5,deep-after=10,wake=2\n"
+        "    --energy-aware <n>       : consolidate work, CPU k only runs processes\n"
+        "                               while at least k*n are ready\n"
+        "    --mlf-levels <n>         : number of -m queues (1-64, default 4)\n"
+        "    --mlf-quanta <list>      : time slice of each -m level, top level first,\n"
+        "                               e.g. 2,4,8x2 (default: doubling per level)\n"
+        "    --mlf-boost <ticks>      : move every process back to the top -m level\n"
+        "                               this often\n"
+        "    --aging <ticks>          : with -p, raise the priority of a waiting\n"
+        "                               process by one every <ticks> ticks\n"
+        "    --checkpoint <tick>:<file> : save the run to <file> at <tick> and stop\n"
+        "    --restore <file>         : continue a run saved with --checkpoint (same\n"
+        "                               workload and CPUs, any scheduler)\n"
+        "    --branch <tick>:<options> : at <tick>, continue the run with <options>\n"
+        "                               added, e.g. --branch 500:\"-m 3\"; give it once\n"
+        "                               per branch, their results are compared\n"
+        "    --metrics <name>         : publish live metrics in shared memory object\n"
+        "                               <name>, watch them with ./simtop <name>\n\n");
+}
 
 /*
  * main() parses command line arguments, initializes globals, and starts simulation
  */
 int main(int argc, char *argv[])
 {
+    sim_config_t config = SIM_CONFIG_DEFAULT;
+    const char *arrivals = NULL;
+    const char *speeds = NULL;
+    const char *quanta = NULL;
+    int mlf_options = 0;
+    int opt, i;
+
+    branch_command(argc, argv);
+
     /* Parse command line args - must include num_cpus as first, rest optional
      * Default is to simulate using just FIFO on given num cpus, if 2nd arg given:
      * if -r, use round robin to schedule, 3rd argument must also be included to 
 	 * set timeslice)
      * if -p, use static priority to schedule
      * Extra Credit: if -m, use multi-level feedback queues, again 3rd arg for timeslice
+     * Remaining options change the workload and how the simulator runs.
      */
-    if (argc == 2) {
-        alg = FIFO;
-        printf("running with basic FIFO\n");
+    alg = FIFO;
+    while ((opt = getopt_long(argc, argv, "r:pm:el:s:g:n:w:f:a:qt:", long_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            alg = RoundRobin;
+            time_slice = atoi(optarg);
+            break;
+        case 'p':
+            alg = StaticPriority;
+            break;
+        case 'm':
+            alg = MultiLevelFeedback;
+            time_slice = atoi(optarg);
+            break;
+        case 'e':
+            alg = EarliestDeadline;
+            break;
+        case 'l':
+            alg = Lottery;
+            time_slice = atoi(optarg);
+            break;
+        case 's':
+            alg = Stride;
+            time_slice = atoi(optarg);
+            break;
+        case 'g':
+            alg = Gang;
+            time_slice = atoi(optarg);
+            break;
+        case 'n': {
+            char* end;
+            unsigned long count = strtoul(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || count == 0 ||
+                count > UINT_MAX) {
+                fprintf(stderr, "-n needs a positive number of processes\n");
+                usage();
+                return -1;
+            }
+            workload_replicate(count);
+            break;
+        }
+        case 'w':
+            if (workgen_generate(optarg) != 0)
+                return -1;
+            break;
+        case 'f':
+            if (workload_load(optarg) != 0)
+                return -1;
+            break;
+        case 'a':
+            arrivals = optarg;
+            break;
+        case 'q':
+            config.quiet = 1;
+            break;
+        case 't':
+            config.tick_usec = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_SWITCH_COST:
+            config.switch_cost = atoi(optarg);
+            break;
+        case OPT_MIGRATION_COST:
+            /* the same cost for every level of the topology */
+            for (i = DOMAIN_LLC; i < DOMAIN_LEVELS; i++)
+                config.topology.migration_cost[i] = atoi(optarg);
+            break;
+        case OPT_TOPOLOGY:
+            if (parse_topology(optarg, &config.topology) != 0) {
+                fprintf(stderr, "invalid topology \"%s\"\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_AFFINITY:
+            affinity = 1;
+            break;
+        case OPT_CPU_SPEEDS:
+            speeds = optarg;
+            break;
+        case OPT_PLACEMENT:
+            placement = 1;
+            break;
+        case OPT_POWER:
+            config.power = (sim_power_t)SIM_POWER_DEFAULT;
+            if (optarg != NULL && parse_power(optarg, &config.power) != 0) {
+                fprintf(stderr, "invalid power model \"%s\"\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_MLF_LEVELS:
+            mlf_options = 1;
+            mlf_levels = atoi(optarg);
+            if (mlf_levels < 1 || mlf_levels > MLF_MAX_LEVELS) {
+                fprintf(stderr, "--mlf-levels must be from 1 to %d\n",
+                        MLF_MAX_LEVELS);
+                return -1;
+            }
+            break;
+        case OPT_MLF_QUANTA:
+            mlf_options = 1;
+            quanta = optarg;
+            break;
+        case OPT_MLF_BOOST:
+            mlf_options = 1;
+            mlf_boost_interval = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_AGING:
+            aging_step = strtoul(optarg, NULL, 10);
+            break;
+        case OPT_CHECKPOINT: {
+            char* end;
+            config.checkpoint_at = strtoul(optarg, &end, 10);
+            if (end == optarg || *end != ':' || end[1] == '\0') {
+                fprintf(stderr, "--checkpoint needs <tick>:<file>\n");
+                return -1;
+            }
+            config.checkpoint_path = end + 1;
+            break;
+        }
+        case OPT_RESTORE:
+            config.restore_path = optarg;
+            break;
+        case OPT_BRANCH: {
+            char* end;
+            unsigned int tick = strtoul(optarg, &end, 10);
+            if (end == optarg || *end != ':') {
+                fprintf(stderr, "--branch needs <tick>:<options>\n");
+                return -1;
+            }
+            if (config.branch && tick != config.checkpoint_at) {
+                fprintf(stderr, "every --branch must start at the same tick\n");
+                return -1;
+            }
+            if (branch_add(end + 1) != 0) {
+                fprintf(stderr, "too many branches, or options in a branch\n");
+                return -1;
+            }
+            config.checkpoint_at = tick;
+            config.branch = 1;
+            break;
+        }
+        case OPT_METRICS:
+            config.metrics_name = optarg;
+            break;
+        case OPT_ENERGY_AWARE:
+            energy_threshold = atoi(optarg);
+            if (energy_threshold <= 0) {
+                fprintf(stderr, "--energy-aware needs a positive number\n");
+                return -1;
+            }
+            break;
+        default:
+            usage();
+            return -1;
+        }
     }
-    else if (argc > 2 && strcmp(argv[2],"-r")==0 && argc > 3) {
-        alg = RoundRobin;
-        time_slice = atoi(argv[3]);
-        printf("running with round robin, time slice = %d\n", time_slice);
+    if (optind != argc - 1) {
+        usage();
+        return -1;
     }
-    else if (argc > 2 && strcmp(argv[2],"-p")==0) {
-        alg = StaticPriority;
-        printf("running with static priority\n");
+    if (config.branch && config.checkpoint_path != NULL) {
+        fprintf(stderr, "--branch and --checkpoint can't be used together\n");
+        return -1;
     }
-  else if (argc > 2 && strcmp(argv[2],"-m")==0 && argc > 3) {
-    alg = MultiLevelFeedback;
-    time_slice = atoi(argv[3]);
-    printf("running with multi-level feedback, time slice = %d\n", time_slice);
-  }
-    else {
-        fprintf(stderr, "Usage: ./simOS <# CPUs> [ -r <time slice> | -m <time slice> | -p ]\n"
-            "    Default : FIFO Scheduler\n"
-            "         -r : Round-Robin Scheduler (must also give time slice)\n"
-            "         -m : Multi-Level Feedback Scheduler (must also give time slice)\n"
-            "         -p : Static Priority Scheduler\n\n");
+    if (mlf_options && alg != MultiLevelFeedback) {
+        fprintf(stderr, "--mlf-levels, --mlf-quanta and --mlf-boost need -m\n");
         return -1;
     }
+    /* applied last so it works with whichever workload was chosen */
+    if (arrivals != NULL && workgen_arrivals(arrivals) != 0)
+        return -1;
+
+    switch (alg) {
+    case FIFO:
+        printf("running with basic FIFO\n");
+        break;
+    case RoundRobin:
+        printf("running with round robin, time slice = %d\n", time_slice);
+        break;
+    case StaticPriority:
+        printf("running with static priority\n");
+        break;
+    case MultiLevelFeedback:
+        printf("running with multi-level feedback, time slice = %d, %d levels\n",
+               time_slice, mlf_levels);
+        break;
+    case EarliestDeadline:
+        printf("running with earliest deadline first\n");
+        break;
+    case Lottery:
+        printf("running with lottery, time slice = %d\n", time_slice);
+        break;
+    case Stride:
+        printf("running with stride, time slice = %d\n", time_slice);
+        break;
+    case Gang:
+        printf("running with gang scheduling, time slice = %d\n", time_slice);
+        break;
+    }
     fflush(stdout);
 
     /* atoi converts string to integer */
-    cpu_count = atoi(argv[1]);
+    cpu_count = atoi(argv[optind]);
+
+    /* the speeds list needs to know how many CPUs there are */
+    if (speeds != NULL) {
+        unsigned long total = 0;
+
+        config.cpu_speed = parse_list(speeds, cpu_count);
+        if (config.cpu_speed == NULL) {
+            fprintf(stderr, "invalid CPU speeds \"%s\"\n", speeds);
+            return -1;
+        }
+        for (i=0; i<cpu_count; i++) {
+            total += config.cpu_speed[i];
+        }
+        mean_speed = total / cpu_count;
+    }
+
+    /* MLF time slices, top level first on the command line */
+    if (alg == MultiLevelFeedback) {
+        unsigned int* list = NULL;
+
+        if (quanta != NULL) {
+            list = parse_list(quanta, mlf_levels);
+            if (list == NULL) {
+                fprintf(stderr, "invalid MLF quanta \"%s\"\n", quanta);
+                return -1;
+            }
+        }
+        mlf_quantum = malloc(sizeof(unsigned int) * mlf_levels);
+        assert(mlf_quantum != NULL);
+        for (i=0; i<mlf_levels; i++) {
+            int depth = mlf_levels - 1 - i;
+            if (list != NULL) {
+                mlf_quantum[i] = list[depth];
+            }
+            else {
+                mlf_quantum[i] = depth < 20 ? (unsigned int)time_slice << depth
+                                            : (unsigned int)time_slice << 20;
+            }
+        }
+        free(list);
+
+        if (mlf_boost_interval > 0) {
+            mlf_epoch = calloc(process_count, sizeof(unsigned int));
+            assert(mlf_epoch != NULL);
+        }
+    }
+
+    ready_since = malloc(sizeof(unsigned int) * process_count);
+    assert(ready_since != NULL);
+
+    /* real-time bookkeeping, when there are deadlines to keep track of */
+    for (i=0; i<process_count; i++) {
+        if (process_table[i].period > 0 || process_table[i].deadline > 0) {
+            rt_processes++;
+        }
+    }
+    if (rt_processes > 0 || alg == EarliestDeadline) {
+        jobs = calloc(process_count, sizeof(rt_job_t));
+        assert(jobs != NULL);
+    }
+    if (alg == EarliestDeadline || alg == Stride) {
+        ready_heap = malloc(sizeof(pcb_t*) * process_count);
+        assert(ready_heap != NULL);
+    }
+    if (alg == Stride) {
+        stride_pass = calloc(process_count, sizeof(uint64_t));
+        assert(stride_pass != NULL);
+    }
+    if (alg == Lottery) {
+        ticket_tree = calloc(process_count + 1, sizeof(long));
+        assert(ticket_tree != NULL);
+        while (tree_top * 2 <= process_count) {
+            tree_top *= 2;
+        }
+    }
+
+    /* gangs, by group number */
+    if (alg == Gang) {
+        for (i=0; i<process_count; i++) {
+            if (process_table[i].group > max_group) {
+                max_group = process_table[i].group;
+            }
+        }
+        gangs = calloc(max_group + 1, sizeof(gang_t));
+        assert(gangs != NULL);
+        for (i=0; i<process_count; i++) {
+            gangs[process_table[i].group].count++;
+        }
+        for (unsigned int g = 1; g <= max_group; g++) {
+            if (gangs[g].count > cpu_count) {
+                fprintf(stderr, "group %u has %u threads, more than the %d "
+                        "CPUs it must run on at once\n", g, gangs[g].count,
+                        cpu_count);
+                return -1;
+            }
+            gangs[g].members = malloc(sizeof(pcb_t*) * gangs[g].count);
+            assert(gangs[g].members != NULL || gangs[g].count == 0);
+            gangs[g].size = 0;
+        }
+        for (i=0; i<process_count; i++) {
+            gang_t* gang = &gangs[process_table[i].group];
+            if (process_table[i].group > 0) {
+                gang->members[gang->size++] = &process_table[i];
+            }
+        }
+        if (energy_threshold > 0) {
+            fprintf(stderr, "--energy-aware can't be used with -g\n");
+            return -1;
+        }
+        gang_assigned = calloc(cpu_count, sizeof(pcb_t*));
+        cpu_idle = malloc(sizeof(int) * cpu_count);
+        assert(gang_assigned != NULL && cpu_idle != NULL);
+        for (i=0; i<cpu_count; i++) {
+            cpu_idle[i] = 1;
+        }
+        idle_cpus = cpu_count;
+    }
 
     /* Allocate the current[] array of cpus and its mutex */
     current = malloc(sizeof(pcb_t*) * cpu_count);
-    int i;
     for (i=0; i<cpu_count; i++) {
         current[i] = NULL;
     }
     assert(current != NULL);
+    preempting = calloc(cpu_count, sizeof(int));
+    assert(preempting != NULL);
     pthread_mutex_init(&current_mutex, NULL);
 
     /* Initialize other necessary synch constructs */
     pthread_mutex_init(&ready_mutex, NULL);
     pthread_cond_init(&ready_empty, NULL);
+    lock_stats_register(&current_mutex_stats, "current_mutex");
+    lock_stats_register(&ready_mutex_stats, "ready_mutex");
 
     /* Start the simulator in the library */
     printf("starting simulator\n");
     fflush(stdout);
-    start_simulator(cpu_count);
+    start_simulator(cpu_count, &config);
 
 
     return 0;
@@ -110,22 +728,30 @@ int main(int argc, char *argv[])
  * returns whether the CPU should idle
  * need slightly more complicated check than simply head==null
  * in order to handle multilevel feedback implementation.
+ * With --energy-aware a CPU also idles while it is parked.
  */
-int should_idle() {
-  // Check head (used for everything except multi-level)
-  int no_procs = head == NULL;
+int should_idle(unsigned int cpu_id) {
+  if (cpu_id >= active_cpus()) {
+    return 1;
+  }
+  if (alg == EarliestDeadline || alg == Stride) {
+    return heap_size == 0;
+  }
+  if (alg == Lottery) {
+    return total_tickets == 0;
+  }
+  if (alg == Gang) {
+    return gang_assigned[cpu_id] == NULL &&
+      (head == NULL || !gang_fits(head, cpu_id));
+  }
 
-  if (alg == MultiLevelFeedback) {
-    // If multi-level, check all the queues
-    for (int i = 3; i >= 0; i--) {
-      if (multi_level_heads[i] != NULL) {
-        // Stop idling if any processes in queue!
-        no_procs = 0;
-        break;
-      }
-    }
+  // If multi-level (or static priority), check all the queues at once
+  if (alg == MultiLevelFeedback || alg == StaticPriority) {
+    return level_nonempty == 0;
   }
-  return no_procs;
+
+  // Check head (used for FIFO and round robin)
+  return head == NULL;
 }
 
 /*
@@ -135,15 +761,17 @@ int should_idle() {
  */
 extern void idle(unsigned int cpu_id)
 {
-  pthread_mutex_lock(&ready_mutex);
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
 
   // Idle while there are no processes ready to run
-  while (should_idle()) {
-    pthread_cond_wait(&ready_empty, &ready_mutex);
+  while (should_idle(cpu_id)) {
+    STAT_COND_WAIT(&ready_empty, &ready_mutex, &ready_mutex_stats);
   }
+  __atomic_fetch_add(&dispatching, 1, __ATOMIC_RELAXED);
 
-  pthread_mutex_unlock(&ready_mutex);
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
   schedule(cpu_id);
+  __atomic_fetch_sub(&dispatching, 1, __ATOMIC_RELEASE);
 }
 
 /*
@@ -159,17 +787,38 @@ extern void idle(unsigned int cpu_id)
  *  a basic getReadyProcess() is implemented below, look at the comments for info.
  */
 static void schedule(unsigned int cpu_id) {
-    pcb_t* proc = getReadyProcess();
+    __atomic_fetch_add(&dispatching, 1, __ATOMIC_RELAXED);
+    pcb_t* proc = getReadyProcess(cpu_id);
 
-    pthread_mutex_lock(&current_mutex);
+    STAT_LOCK(&current_mutex, &current_mutex_stats);
     current[cpu_id] = proc;
-    pthread_mutex_unlock(&current_mutex);
+    preempting[cpu_id] = 0;
+    STAT_UNLOCK(&current_mutex, &current_mutex_stats);
 
     if (proc!=NULL) {
         proc->state = PROCESS_RUNNING;
     }
 
-    context_switch(cpu_id, proc, time_slice); 
+    // under MLF the time slice depends on the process's level (which a
+    // boost may have reset since it was queued)
+    int slice = time_slice;
+    if (alg == MultiLevelFeedback && proc != NULL) {
+        slice = mlf_quantum[mlf_level(proc)];
+    }
+
+    // an idle CPU gets here while time goes on, so the simulator says when
+    // the process was dispatched
+    unsigned int now = context_switch(cpu_id, proc, slice);
+
+    if (proc!=NULL) {
+        STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+        unsigned int waited = now - ready_since[process_index(proc)];
+        if (waited > max_ready_wait[proc->static_priority]) {
+            max_ready_wait[proc->static_priority] = waited;
+        }
+        STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+    }
+    __atomic_fetch_sub(&dispatching, 1, __ATOMIC_RELEASE);
 }
 
 
@@ -185,15 +834,31 @@ static void schedule(unsigned int cpu_id) {
  *
  */
 extern void preempt(unsigned int cpu_id) {
-  pthread_mutex_lock(&current_mutex);
+  STAT_LOCK(&current_mutex, &current_mutex_stats);
   current[cpu_id]->state = PROCESS_READY;
+  unsigned int used = charge_cpu(cpu_id);
 
   // If MLF scheduler, also decrement priority if possible
-  if (alg == MultiLevelFeedback && current[cpu_id]->temp_priority > 0) {
+  if (alg == MultiLevelFeedback && mlf_level(current[cpu_id]) > 0) {
     current[cpu_id]->temp_priority--;
   }
 
-  pthread_mutex_unlock(&current_mutex);
+  // a gang's time slice ends on all of its CPUs together
+  unsigned int group = current[cpu_id]->group;
+  if (alg == Gang && group > 0) {
+    for (int i = 0; i < cpu_count; i++) {
+      if (i != cpu_id && current[i] != NULL && current[i]->group == group &&
+          !preempting[i]) {
+        preempting[i] = 1;
+        force_preempt(i);
+      }
+    }
+  }
+
+  STAT_UNLOCK(&current_mutex, &current_mutex_stats);
+  if (alg == Stride) {
+    stride_charge(current[cpu_id], used);
+  }
   addReadyProcess(current[cpu_id]);
   schedule(cpu_id);
 }
@@ -208,15 +873,21 @@ extern void preempt(unsigned int cpu_id) {
  */
 extern void yield(unsigned int cpu_id) {
     // use lock to ensure thread-safe access to current process
-    pthread_mutex_lock(&current_mutex);
+    STAT_LOCK(&current_mutex, &current_mutex_stats);
     current[cpu_id]->state = PROCESS_WAITING;
+    unsigned int used = charge_cpu(cpu_id);
+    rt_complete(current[cpu_id]);
 
     // If MLF scheduler, also increment priority if possible
-    if (alg == MultiLevelFeedback && current[cpu_id]->temp_priority < 3) {
+    if (alg == MultiLevelFeedback &&
+        mlf_level(current[cpu_id]) < mlf_levels - 1) {
       current[cpu_id]->temp_priority++;
     }
 
-    pthread_mutex_unlock(&current_mutex);
+    STAT_UNLOCK(&current_mutex, &current_mutex_stats);
+    if (alg == Stride) {
+      stride_charge(current[cpu_id], used);
+    }
     schedule(cpu_id);
 }
 
@@ -229,12 +900,77 @@ extern void yield(unsigned int cpu_id) {
  */
 extern void terminate(unsigned int cpu_id) {
     // use lock to ensure thread-safe access to current process
-    pthread_mutex_lock(&current_mutex);
+    STAT_LOCK(&current_mutex, &current_mutex_stats);
     current[cpu_id]->state = PROCESS_TERMINATED;
-    pthread_mutex_unlock(&current_mutex);
+    charge_cpu(cpu_id);
+    rt_complete(current[cpu_id]);
+
+    // the first priority to run out of processes ends the shared period
+    unsigned int priority = current[cpu_id]->static_priority;
+    if (--live_processes[priority] == 0 && share_time == 0) {
+      share_time = get_simulator_time();
+      memcpy(share_ticks, cpu_ticks, sizeof(cpu_ticks));
+    }
+    STAT_UNLOCK(&current_mutex, &current_mutex_stats);
+
+    if (alg == Gang && current[cpu_id]->group > 0) {
+      gang_exit(current[cpu_id]);
+    }
     schedule(cpu_id);
 }
 
+/*
+ * preempt_for() preempts the CPU running the least urgent process if process,
+ * which has just been queued, is more urgent and no CPU is idle.  Only the
+ * static priority and EDF schedulers preempt.
+ */
+static void preempt_for(pcb_t *process) {
+  if (alg != StaticPriority && alg != EarliestDeadline) {
+    return;
+  }
+
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+  int active = active_cpus();
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+
+  STAT_LOCK(&current_mutex, &current_mutex_stats);
+
+	//** FIX **
+  pcb_t* lowest_priority_process = NULL;
+  int lowest_priority_index = -1;
+
+  for (int i = 0; i < cpu_count; i++) {
+    pcb_t* curr = current[i];
+
+    if (curr == NULL && i < active) {
+      // If any CPU is idling, don't preempt!
+      STAT_UNLOCK(&current_mutex, &current_mutex_stats);
+      return;
+    }
+    if (curr == NULL || preempting[i]) {
+      // parked by --energy-aware, it won't pick the process up, or
+      // already being preempted and will pick the best process anyway
+      continue;
+    }
+
+    if (lowest_priority_process == NULL ||
+        more_urgent(lowest_priority_process, curr)) {
+      // Find the process with the lowest priority and replace it
+      lowest_priority_process = curr;
+      lowest_priority_index = i;
+    }
+  }
+
+  if (lowest_priority_process != NULL &&
+      more_urgent(process, lowest_priority_process)) {
+    // If current process' priority is higher than that of the lowest priority process,
+    // preempt it!
+    preempting[lowest_priority_index] = 1;
+    force_preempt(lowest_priority_index);
+  }
+  STAT_UNLOCK(&current_mutex, &current_mutex_stats);
+}
+
 /*
  * wake_up() is called for a new process and when an I/O request completes.
  * For all 3 scheduling algorithms, mark process as READY and call
@@ -245,49 +981,852 @@ extern void terminate(unsigned int cpu_id) {
  *
  * Static priority scheduling IS preemptive, so if all processes are in use,
  * and lowest priority process currently running is lower than process just
- * woken up, preempt CPU with that lowest priority process. The force_preempt
- * function will actually handle calling preempt to schedule the next process.
+ * woken up, preempt CPU with that lowest priority process. force_preempt only
+ * posts the request; the simulator calls preempt on that CPU at the end of
+ * the tick, so until schedule runs there the CPU is marked in preempting[]
+ * and other wake_ups pick a different victim.
+ * EDF preempts the same way, with the latest deadline playing the part of
+ * the lowest priority.
  */
 extern void wake_up(pcb_t *process) {
   // If MLF scheduler and this is a new process, start it with highest priority
   if (alg == MultiLevelFeedback && process->state == PROCESS_NEW) {
-    process->temp_priority = 3;
+    process->temp_priority = mlf_levels - 1;
+    if (mlf_epoch != NULL) {
+      mlf_epoch[process_index(process)] =
+        get_simulator_time() / mlf_boost_interval;
+    }
+  }
+
+  if (process->state == PROCESS_NEW) {
+    STAT_LOCK(&current_mutex, &current_mutex_stats);
+    live_processes[process->static_priority]++;
+    STAT_UNLOCK(&current_mutex, &current_mutex_stats);
+  }
+
+  // a new job is released (processes without deadlines are tracked too)
+  if (jobs != NULL) {
+    STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+    rt_release(process);
+    STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
   }
 
   process->state = PROCESS_READY;
   addReadyProcess(process);
+  preempt_for(process);
+}
 
-  if (alg == StaticPriority) {
-    pthread_mutex_lock(&current_mutex);
 
-	//** FIX **
-    unsigned int lowest_priority = 11;
-    int lowest_priority_index = -1;
+/*
+ * more_urgent() says whether process a should run before (and may preempt)
+ * process b: higher static priority, or earlier deadline for EDF.
+ */
+static int more_urgent(pcb_t* a, pcb_t* b) {
+  if (alg == EarliestDeadline) {
+    rt_job_t* ja = &jobs[process_index(a)];
+    rt_job_t* jb = &jobs[process_index(b)];
+    return ja->deadline < jb->deadline;
+  }
+  return a->static_priority > b->static_priority;
+}
+
+
+/*
+ * rt_release() starts a process's next job when it wakes up.  The release
+ * is held back to one period after the previous one if the process is
+ * early (a sporadic task), and the deadline counts from the release.
+ * Called with ready_mutex held.
+ */
+static void rt_release(pcb_t* proc) {
+  rt_job_t* job = &jobs[process_index(proc)];
+  unsigned int now = get_simulator_time();
+  unsigned int relative = proc->deadline ? proc->deadline : proc->period;
+
+  if (proc->state != PROCESS_NEW && proc->period > 0 &&
+      job->release + proc->period > now) {
+    job->release = job->release + proc->period;
+  }
+  else {
+    job->release = now;
+  }
+  job->deadline = relative ? job->release + relative : NO_DEADLINE;
+}
+
+
+/*
+ * charge_cpu() charges the CPU time the running process has used since it
+ * was dispatched to its priority, and to its job, and returns it.  Called
+ * with current_mutex held.
+ */
+static unsigned int charge_cpu(unsigned int cpu_id) {
+  unsigned int used = cpu_run_ticks(cpu_id);
+
+  cpu_ticks[current[cpu_id]->static_priority] += used;
+  if (jobs != NULL) {
+    jobs[process_index(current[cpu_id])].demand += used;
+  }
+  return used;
+}
+
+
+/*
+ * stride_charge() moves a process that leaves the CPU on by the time it
+ * used: a whole stride for a full time slice, less if it yields early.
+ */
+static void stride_charge(pcb_t* proc, unsigned int used) {
+  uint64_t slice = time_slice > 0 ? time_slice : 1;
+
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+  stride_pass[process_index(proc)] +=
+    (uint64_t)STRIDE1 * used / (tickets(proc) * slice);
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+}
+
+
+/*
+ * rt_complete() records a finished job: on time, or how late.  Called with
+ * current_mutex held.
+ */
+static void rt_complete(pcb_t* proc) {
+  if (jobs == NULL) {
+    return;
+  }
+
+  rt_job_t* job = &jobs[process_index(proc)];
+  unsigned int now = get_simulator_time();
+
+  if (job->demand > job->max_demand) {
+    job->max_demand = job->demand;
+  }
+  job->demand = 0;
+  if (job->deadline == NO_DEADLINE) {
+    return;
+  }
+
+  jobs_done++;
+  if (now <= job->deadline) {
+    lateness_hist[0]++;
+    return;
+  }
+
+  unsigned int late = now - job->deadline;
+  int bucket = 1;
+  while (bucket < LATENESS_BUCKETS - 1 && late >= (1u << bucket)) {
+    bucket++;
+  }
+  lateness_hist[bucket]++;
+  jobs_missed++;
+  total_lateness += late;
+  if (late > max_lateness) {
+    max_lateness = late;
+  }
+}
+
+
+/*
+ * The ready heap.  For EDF heap_before() orders jobs by deadline, then by
+ * the order they were queued so processes without deadlines (and ties)
+ * stay FIFO.  For stride it orders by pass, then by the time queued.
+ */
+static int heap_before(pcb_t* a, pcb_t* b) {
+  unsigned int ia = process_index(a), ib = process_index(b);
+
+  if (alg == Stride) {
+    if (stride_pass[ia] != stride_pass[ib]) {
+      return stride_pass[ia] < stride_pass[ib];
+    }
+    if (ready_since[ia] != ready_since[ib]) {
+      return ready_since[ia] < ready_since[ib];
+    }
+    return ia < ib;
+  }
+
+  if (jobs[ia].deadline != jobs[ib].deadline) {
+    return jobs[ia].deadline < jobs[ib].deadline;
+  }
+  return jobs[ia].seq < jobs[ib].seq;
+}
+
+static void heap_push(pcb_t* proc) {
+  unsigned int i = heap_size++;
+
+  while (i > 0 && heap_before(proc, ready_heap[(i - 1) / 2])) {
+    ready_heap[i] = ready_heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  ready_heap[i] = proc;
+}
+
+static pcb_t* heap_pop(void) {
+  pcb_t* first = ready_heap[0];
+  pcb_t* last = ready_heap[--heap_size];
+  unsigned int i = 0, child;
+
+  while ((child = 2 * i + 1) < heap_size) {
+    if (child + 1 < heap_size && heap_before(ready_heap[child + 1], ready_heap[child])) {
+      child++;
+    }
+    if (!heap_before(ready_heap[child], last)) {
+      break;
+    }
+    ready_heap[i] = ready_heap[child];
+    i = child;
+  }
+  ready_heap[i] = last;
+  return first;
+}
+
+
+/* tree_add() adds (or with negative tickets, removes) a process's tickets */
+static void tree_add(unsigned int index, long tickets) {
+  for (unsigned int i = index + 1; i <= process_count; i += i & -i) {
+    ticket_tree[i] += tickets;
+  }
+  total_tickets += tickets;
+}
+
+/*
+ * tree_draw() picks a ready process at random, weighted by tickets, and
+ * removes it from the tree.  The walk down the tree finds the process
+ * holding the drawn ticket.
+ */
+static pcb_t* tree_draw(void) {
+  uint64_t x = lottery_rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  lottery_rng = x;
+
+  long ticket = (long)((x * 0x2545f4914f6cdd1dull) % total_tickets);
+  unsigned int pos = 0;
+
+  for (unsigned int step = tree_top; step > 0; step >>= 1) {
+    if (pos + step <= process_count && ticket_tree[pos + step] <= ticket) {
+      pos += step;
+      ticket -= ticket_tree[pos];
+    }
+  }
+
+  pcb_t* proc = &process_table[pos];
+  tree_add(pos, -(long)tickets(proc));
+  return proc;
+}
+
+
+/*
+ * sched_queue_depths() fills depths[] with the number of processes in each
+ * ready queue, lowest priority first, and returns how many queues there
+ * are: the MLF levels, one per static priority, or else just one.
+ */
+extern unsigned int sched_queue_depths(unsigned int* depths, unsigned int max) {
+  unsigned int levels = 1;
+
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+  if (alg == MultiLevelFeedback || alg == StaticPriority) {
+    levels = alg == MultiLevelFeedback ? mlf_levels : 11;
+    if (levels > max) {
+      levels = max;
+    }
+    memcpy(depths, level_count, sizeof(unsigned int) * levels);
+  }
+  else if (max > 0) {
+    depths[0] = ready_count;
+  }
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+  return levels;
+}
+
+/*
+ * print_sched_stats() reports the longest wait in the ready queue for each
+ * priority, the CPU share of each priority for the proportional share
+ * schedulers, and for workloads with deadlines how well they were met, with a
+ * check of the real-time processes for schedulability under global EDF
+ * (using the longest CPU burst seen from each as its worst-case execution
+ * time).
+ */
+extern void print_sched_stats(void) {
+  int waited = 0;
+  printf("\nLongest time READY by priority:");
+  for (int p = 10; p >= 0; p--) {
+    if (max_ready_wait[p] > 0) {
+      printf(" %d: %.1f s", p, max_ready_wait[p] / 10.0);
+      waited = 1;
+    }
+  }
+  printf("%s\n", waited ? "" : " none");
+
+  unsigned long total = 0;
+  for (int p = 0; p <= 10; p++) {
+    total += share_ticks[p];
+  }
+  if ((alg == Lottery || alg == Stride) && total > 0) {
+    printf("CPU share by priority (tickets) over the first %.1f s, until "
+           "a priority ran out of processes:\n", share_time / 10.0);
+    for (int p = 10; p >= 0; p--) {
+      if (share_ticks[p] > 0) {
+        printf("  %2d (%2d): %5.1f%%\n", p, p + 1,
+               100.0 * share_ticks[p] / total);
+      }
+    }
+  }
+
+  if (alg == Gang) {
+    unsigned long capacity = (unsigned long)cpu_count * get_simulator_time();
+
+    gang_account();
+    printf("Gangs dispatched: %lu, %.1f threads each\n", gangs_dispatched,
+           gangs_dispatched ? (double)gang_threads / gangs_dispatched : 0.0);
+    printf("CPU time idle: %.1f s (%.1f%%), of which with processes ready "
+           "(fragmentation): %.1f s (%.1f%%)\n", idle_ticks / 10.0,
+           capacity ? 100.0 * idle_ticks / capacity : 0.0,
+           fragment_ticks / 10.0,
+           capacity ? 100.0 * fragment_ticks / capacity : 0.0);
+  }
+
+  if (rt_processes == 0) {
+    return;
+  }
+
+  printf("\nReal-time jobs: %lu, deadlines missed: %lu (%.1f%%)\n", jobs_done,
+         jobs_missed, jobs_done ? 100.0 * jobs_missed / jobs_done : 0.0);
+  if (jobs_missed > 0) {
+    printf("Lateness of missed jobs: mean %.1f s, max %.1f s\n",
+           total_lateness / 10.0 / jobs_missed, max_lateness / 10.0);
+  }
+  printf("Lateness (ticks)   jobs\n");
+  printf("  on time        %7lu\n", lateness_hist[0]);
+  for (int b = 1; b < LATENESS_BUCKETS; b++) {
+    if (lateness_hist[b] == 0) {
+      continue;
+    }
+    if (b == LATENESS_BUCKETS - 1) {
+      printf("  %5u+         %7lu\n", 1u << (b - 1), lateness_hist[b]);
+    }
+    else if (b == 1) {
+      printf("  %5u          %7lu\n", 1u, lateness_hist[b]);
+    }
+    else {
+      printf("  %5u-%-5u    %7lu\n", 1u << (b - 1), (1u << b) - 1,
+             lateness_hist[b]);
+    }
+  }
+
+  // utilization and density of the processes with a period
+  double utilization = 0, density = 0, max_density = 0;
+  for (unsigned int i = 0; i < process_count; i++) {
+    pcb_t* proc = &process_table[i];
+    if (proc->period == 0) {
+      continue;
+    }
+    unsigned int window = proc->deadline && proc->deadline < proc->period ?
+      proc->deadline : proc->period;
+    double d = (double)jobs[i].max_demand / window;
+    utilization += (double)jobs[i].max_demand / proc->period;
+    density += d;
+    if (d > max_density) {
+      max_density = d;
+    }
+  }
+
+  printf("Schedulability of the periodic processes, all active at once: "
+         "utilization %.2f, density %.2f on %d CPUs - ", utilization, density,
+         cpu_count);
+  if (utilization > cpu_count) {
+    printf("overloaded\n");
+  }
+  else if (density <= cpu_count - (cpu_count - 1) * max_density) {
+    printf("schedulable by EDF (density test)\n");
+  }
+  else {
+    printf("not guaranteed\n");
+  }
+}
+
+
+/*
+ * Checkpoints (see checkpoint.h).  The scheduler saves what each CPU is
+ * running, the ready processes in the order they were queued, the stamps
+ * the queues are ordered by (ready_since[], jobs[], stride_pass[]) and its
+ * statistics.  sched_restore() queues the processes again with whichever
+ * algorithm is in use now, so a run can go on under a different scheduler
+ * from the same state.  Both are called while no CPU is using the
+ * scheduler: once sched_settled(), or before the CPU threads start.
+ */
+static const checkpoint_var_t sched_vars[] = {
+  CHECKPOINT_VAR(max_ready_wait),
+  CHECKPOINT_VAR(mlf_boosted_epoch),
+  CHECKPOINT_VAR(jobs_done),
+  CHECKPOINT_VAR(jobs_missed),
+  CHECKPOINT_VAR(total_lateness),
+  CHECKPOINT_VAR(max_lateness),
+  CHECKPOINT_VAR(queue_seq),
+  CHECKPOINT_VAR(lateness_hist),
+  CHECKPOINT_VAR(lottery_rng),
+  CHECKPOINT_VAR(global_pass),
+  CHECKPOINT_VAR(cpu_ticks),
+  CHECKPOINT_VAR(share_ticks),
+  CHECKPOINT_VAR(share_time),
+  CHECKPOINT_VAR(live_processes),
+  CHECKPOINT_VAR(gang_accounted_at),
+  CHECKPOINT_VAR(gangs_dispatched),
+  CHECKPOINT_VAR(gang_threads),
+  CHECKPOINT_VAR(idle_ticks),
+  CHECKPOINT_VAR(fragment_ticks),
+};
+
+#define SCHED_VARS (sizeof(sched_vars) / sizeof(sched_vars[0]))
+
+/*
+ * sched_settled() says whether no idle CPU is on its way to a process: none
+ * has left idle() with one, and none would leave it now.  Until then a
+ * process may be out of the ready queue but not yet on its CPU.
+ */
+extern int sched_settled(void) {
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+  STAT_LOCK(&current_mutex, &current_mutex_stats);
+  int settled = __atomic_load_n(&dispatching, __ATOMIC_ACQUIRE) == 0;
+  for (int i = 0; i < cpu_count && settled; i++) {
+    if (current[i] == NULL && !should_idle(i)) {
+      settled = 0;
+    }
+  }
+  STAT_UNLOCK(&current_mutex, &current_mutex_stats);
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+  return settled;
+}
+
+static void save_process(FILE* file, pcb_t* proc) {
+  int index = proc != NULL ? (int)process_index(proc) : -1;
+  checkpoint_write(file, &index, sizeof(index));
+}
+
+static pcb_t* restore_process(FILE* file) {
+  int index;
+  checkpoint_read(file, &index, sizeof(index));
+  if (index < -1 || index >= (int)process_count) {
+    checkpoint_fail("corrupt checkpoint");
+  }
+  return index >= 0 ? &process_table[index] : NULL;
+}
+
+extern void sched_save(FILE* file) {
+  pcb_t** list = malloc(sizeof(pcb_t*) * process_count);
+  char* listed = calloc(process_count, 1);
+  unsigned int queued = 0, count;
+
+  assert(list != NULL && listed != NULL);
+  checkpoint_write(file, &alg, sizeof(alg));
+  checkpoint_write(file, &mlf_levels, sizeof(mlf_levels));
+  checkpoint_write_vars(file, sched_vars, SCHED_VARS);
+  checkpoint_write_array(file, ready_since, sizeof(unsigned int) * process_count);
+  checkpoint_write_array(file, preempting, sizeof(int) * cpu_count);
+  checkpoint_write_array(file, jobs, sizeof(rt_job_t) * process_count);
+  checkpoint_write_array(file, stride_pass, sizeof(uint64_t) * process_count);
+  checkpoint_write_array(file, mlf_epoch, sizeof(unsigned int) * process_count);
+  for (int i = 0; i < cpu_count; i++) {
+    save_process(file, current[i]);
+  }
+
+  // the queues in the order they are taken from: the heap in its array
+  // order (pushing it again in that order rebuilds it exactly), the higher
+  // levels first
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+  if (alg == EarliestDeadline || alg == Stride) {
+    for (unsigned int i = 0; i < heap_size; i++) {
+      list[queued++] = ready_heap[i];
+    }
+  }
+  else if (alg == MultiLevelFeedback || alg == StaticPriority) {
+    for (int level = MLF_MAX_LEVELS - 1; level >= 0; level--) {
+      for (pcb_t* p = multi_level_heads[level]; p != NULL; p = p->next) {
+        list[queued++] = p;
+      }
+    }
+  }
+  else if (alg != Lottery) {
+    for (pcb_t* p = head; p != NULL; p = p->next) {
+      list[queued++] = p;
+    }
+  }
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
 
+  // then the lottery's processes, and gang threads waiting for the rest of
+  // their gang, which go first so each gang is queued where it was
+  count = queued;
+  for (unsigned int i = 0; i < queued; i++) {
+    listed[process_index(list[i])] = 1;
+  }
+  for (unsigned int i = 0; i < process_count; i++) {
+    if (process_table[i].state == PROCESS_READY && !listed[i]) {
+      list[count++] = &process_table[i];
+    }
+  }
+  checkpoint_write(file, &count, sizeof(count));
+  for (unsigned int i = queued; i < count; i++) {
+    save_process(file, list[i]);
+  }
+  for (unsigned int i = 0; i < queued; i++) {
+    save_process(file, list[i]);
+  }
+  free(list);
+  free(listed);
+}
+
+extern void sched_restore(FILE* file) {
+  scheduler_alg saved_alg;
+  int saved_levels;
+  unsigned int count, now = get_simulator_time();
+
+  checkpoint_read(file, &saved_alg, sizeof(saved_alg));
+  checkpoint_read(file, &saved_levels, sizeof(saved_levels));
+  checkpoint_read_vars(file, sched_vars, SCHED_VARS);
+  checkpoint_read_array(file, ready_since, sizeof(unsigned int) * process_count);
+  checkpoint_read_array(file, preempting, sizeof(int) * cpu_count);
+  if (!checkpoint_read_array(file, jobs, sizeof(rt_job_t) * process_count) &&
+      jobs != NULL) {
+    // -e on a workload without deadlines: none of the jobs has one
+    for (unsigned int i = 0; i < process_count; i++) {
+      jobs[i].deadline = NO_DEADLINE;
+    }
+  }
+  checkpoint_read_array(file, stride_pass, sizeof(uint64_t) * process_count);
+  if (!checkpoint_read_array(file, mlf_epoch,
+                             sizeof(unsigned int) * process_count) &&
+      mlf_epoch != NULL) {
+    for (unsigned int i = 0; i < process_count; i++) {
+      mlf_epoch[i] = now / mlf_boost_interval;
+    }
+  }
+  for (int i = 0; i < cpu_count; i++) {
+    current[i] = restore_process(file);
+  }
+
+  // MLF levels from another algorithm (or number of levels) don't apply,
+  // every process starts again at the top
+  if (alg == MultiLevelFeedback &&
+      (saved_alg != MultiLevelFeedback || saved_levels != mlf_levels)) {
+    for (unsigned int i = 0; i < process_count; i++) {
+      process_table[i].temp_priority = mlf_levels - 1;
+    }
+  }
+
+  // gangs lose the threads that have terminated, and CPUs are idle as saved
+  if (alg == Gang) {
+    for (unsigned int i = 0; i < process_count; i++) {
+      if (process_table[i].group > 0 &&
+          process_table[i].state == PROCESS_TERMINATED) {
+        gangs[process_table[i].group].size--;
+      }
+    }
+    idle_cpus = 0;
     for (int i = 0; i < cpu_count; i++) {
-      pcb_t* curr = current[i];
+      cpu_idle[i] = current[i] == NULL;
+      idle_cpus += cpu_idle[i];
+    }
+    if (saved_alg != Gang) {
+      gang_accounted_at = now;
+    }
+  }
+
+  checkpoint_read(file, &count, sizeof(count));
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+  for (unsigned int i = 0; i < count; i++) {
+    pcb_t* proc = restore_process(file);
+    if (proc == NULL || proc->state != PROCESS_READY) {
+      checkpoint_fail("corrupt checkpoint");
+    }
+    if (alg == EarliestDeadline && saved_alg != EarliestDeadline) {
+      jobs[process_index(proc)].seq = queue_seq++;
+    }
+    enqueue(proc);
+  }
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+}
 
-      if (curr == NULL) {
-        // If any CPU is idling, don't preempt!
-        pthread_mutex_unlock(&current_mutex);
-        return;
+
+/*
+ * mlf_level() returns a process's MLF level, first putting it back at the
+ * top if a priority boost has happened since it was last looked at.
+ */
+static int mlf_level(pcb_t* proc) {
+  if (mlf_epoch != NULL) {
+    unsigned int epoch = get_simulator_time() / mlf_boost_interval;
+    if (mlf_epoch[process_index(proc)] != epoch) {
+      mlf_epoch[process_index(proc)] = epoch;
+      proc->temp_priority = mlf_levels - 1;
+    }
+  }
+  return proc->temp_priority;
+}
+
+
+/*
+ * mlf_boost() applies a pending priority boost to the ready queues by
+ * appending every lower queue to the top one, highest first, so the order
+ * within the top queue is by former level.  Called with ready_mutex held.
+ */
+static void mlf_boost(void) {
+  unsigned int epoch = get_simulator_time() / mlf_boost_interval;
+  int top = mlf_levels - 1;
+
+  if (epoch == mlf_boosted_epoch) {
+    return;
+  }
+  mlf_boosted_epoch = epoch;
+
+  for (int i = top - 1; i >= 0; i--) {
+    if (multi_level_heads[i] == NULL) {
+      continue;
+    }
+    if (multi_level_heads[top] == NULL) {
+      multi_level_heads[top] = multi_level_heads[i];
+    }
+    else {
+      multi_level_tails[top]->next = multi_level_heads[i];
+    }
+    multi_level_tails[top] = multi_level_tails[i];
+    multi_level_heads[i] = multi_level_tails[i] = NULL;
+    level_count[top] += level_count[i];
+    level_count[i] = 0;
+  }
+  if (multi_level_heads[top] != NULL) {
+    level_nonempty = (uint64_t)1 << top;
+  }
+}
+
+
+/*
+ * best_level() picks the queue to take the next process from: the highest
+ * non-empty one from the bitmap, or with aging the one whose head has the
+ * highest effective priority (on a tie, the higher static priority).
+ * Returns 0 if all are empty.  Called with ready_mutex held.
+ */
+static int best_level(void) {
+  if (level_nonempty == 0) {
+    return 0;
+  }
+  if (alg != StaticPriority || aging_step == 0) {
+    return 63 - __builtin_clzll(level_nonempty);
+  }
+
+  unsigned int now = get_simulator_time();
+  unsigned int best_priority = 0;
+  int best = 0;
+
+  for (uint64_t bits = level_nonempty; bits != 0; bits &= bits - 1) {
+    int level = __builtin_ctzll(bits);
+    pcb_t* first = multi_level_heads[level];
+    unsigned int priority = level +
+      (now - ready_since[process_index(first)]) / aging_step;
+
+    if (priority >= best_priority) {
+      best_priority = priority;
+      best = level;
+    }
+  }
+  return best;
+}
+
+
+/*
+ * gang_account() adds the CPU time spent idle since the last call, in total
+ * and while the ready queue wasn't empty.  Called with ready_mutex held
+ * before the queue or the idle CPUs change.
+ */
+static void gang_account(void) {
+  unsigned int now = get_simulator_time();
+  unsigned long idle = (unsigned long)(now - gang_accounted_at) * idle_cpus;
+
+  idle_ticks += idle;
+  if (head != NULL) {
+    fragment_ticks += idle;
+  }
+  gang_accounted_at = now;
+}
+
+
+/*
+ * gang_fits() says whether proc (and the rest of its gang) can be started
+ * now by cpu_id, with the idle CPUs that haven't been handed a thread yet.
+ * Called with ready_mutex held.
+ */
+static int gang_fits(pcb_t* proc, unsigned int cpu_id) {
+  unsigned int free_cpus = 1;
+
+  if (proc->group == 0) {
+    return 1;
+  }
+  for (int i = 0; i < cpu_count; i++) {
+    if (i != cpu_id && cpu_idle[i] && gang_assigned[i] == NULL) {
+      free_cpus++;
+    }
+  }
+  return gangs[proc->group].size <= free_cpus;
+}
+
+
+/*
+ * gang_pick() returns the thread handed to cpu_id, or else the head of the
+ * queue if it fits, handing the rest of its gang to other idle CPUs and
+ * waking them.  Returns NULL if cpu_id has to wait.  Called with ready_mutex
+ * held.
+ */
+static pcb_t* gang_pick(unsigned int cpu_id) {
+  pcb_t* first = gang_assigned[cpu_id];
+
+  if (first != NULL) {
+    gang_assigned[cpu_id] = NULL;
+    return first;
+  }
+  if (head == NULL || !gang_fits(head, cpu_id)) {
+    return NULL;
+  }
+
+  first = head;
+  head = first->next;
+  if (head == NULL) {
+    tail = NULL;
+  }
+  ready_count--;
+
+  if (first->group > 0) {
+    gang_t* gang = &gangs[first->group];
+    int cpu = 0;
+
+    for (unsigned int i = 0; i < gang->count; i++) {
+      pcb_t* thread = gang->members[i];
+      if (thread == first || thread->state != PROCESS_READY) {
+        continue;
       }
+      while (cpu == cpu_id || !cpu_idle[cpu] || gang_assigned[cpu] != NULL) {
+        cpu++;
+      }
+      assert(cpu < cpu_count);
+      gang_assigned[cpu] = thread;
+    }
+    gang->ready = 0;
+    gangs_dispatched++;
+    gang_threads += gang->size;
+    pthread_cond_broadcast(&ready_empty);
+  }
+  return first;
+}
 
-      if (curr->static_priority < lowest_priority) {
-        // Find the process with the lowest priority and replace it
-        lowest_priority = curr->static_priority;
-        lowest_priority_index = i;
+
+/*
+ * gang_exit() removes a terminated thread from its gang, queueing the gang
+ * if the other threads were only waiting for this one.
+ */
+static void gang_exit(pcb_t* proc) {
+  gang_t* gang = &gangs[proc->group];
+
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+  gang->size--;
+  if (gang->size > 0 && gang->ready == gang->size) {
+    for (unsigned int i = 0; i < gang->count; i++) {
+      if (gang->members[i]->state == PROCESS_READY) {
+        gang_account();
+        addToList(gang->members[i]);
+        ready_count++;
+        pthread_cond_signal(&ready_empty);
+        break;
       }
     }
+  }
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+}
 
-    pthread_mutex_unlock(&current_mutex);
 
-    if (lowest_priority < process->static_priority) {
-      // If current process' priority is higher than that of the lowest priority process,
-      // preempt it!
-      force_preempt(lowest_priority_index);
+/*
+ * active_cpus() returns how many CPUs (counting from CPU 0) may run processes
+ * at the moment: all of them, unless --energy-aware is parking some.  Must
+ * be called with ready_mutex held.
+ */
+static int active_cpus(void) {
+  if (energy_threshold == 0) {
+    return cpu_count;
+  }
+  unsigned int wanted = 1 + ready_count / energy_threshold;
+  return wanted < cpu_count ? wanted : cpu_count;
+}
+
+
+/*
+ * affinity_score() rates how cheap it is to run proc on cpu_id: 0 if it last
+ * ran there, otherwise how far away its last CPU is.  A process that hasn't
+ * run yet has no cache state to reuse, so it comes after one that last ran
+ * on cpu_id and scores as if it had run on a neighbour (DOMAIN_LLC).
+ */
+static int affinity_score(pcb_t* proc, unsigned int cpu_id) {
+  if (proc->last_cpu < 0) {
+    return DOMAIN_LLC;
+  }
+  return cpu_distance(proc->last_cpu, cpu_id);
+}
+
+
+/*
+ * pick_score() combines the enabled placement preferences, lower is better.
+ * A process on the wrong kind of core (CPU-bound on a slower than average
+ * CPU, or I/O-bound on a faster one) scores worse than any migration.
+ */
+static int pick_score(pcb_t* proc, unsigned int cpu_id) {
+  int score = 0;
+
+  if (affinity) {
+    score += affinity_score(proc, cpu_id);
+  }
+  if (placement) {
+    unsigned int speed = cpu_speed(cpu_id);
+    if ((proc->name[0] == 'C' && speed < mean_speed) ||
+        (proc->name[0] == 'I' && speed > mean_speed)) {
+      score += DOMAIN_LEVELS;
     }
   }
+  return score;
+}
+
+/*
+ * parse_list() turns a list of positive numbers like "200x2,150,100x4"
+ * (CPU speeds, MLF quanta) into count values, repeating the last one if
+ * fewer are listed.  Returns NULL if the list is invalid.
+ */
+static unsigned int* parse_list(const char* text, unsigned int count) {
+  unsigned int* speeds = malloc(sizeof(unsigned int) * count);
+  unsigned int speed = 0, repeat, n = 0;
+  int used;
+
+  assert(speeds != NULL);
+  while (n < count && *text != '\0') {
+    if (sscanf(text, "%u%n", &speed, &used) != 1 || speed == 0) {
+      free(speeds);
+      return NULL;
+    }
+    text += used;
+    repeat = 1;
+    if (*text == 'x' && (sscanf(text + 1, "%u%n", &repeat, &used) != 1 ||
+                         repeat == 0)) {
+      free(speeds);
+      return NULL;
+    }
+    if (*text == 'x') {
+      text += used + 1;
+    }
+    while (repeat-- > 0 && n < count) {
+      speeds[n++] = speed;
+    }
+    if (*text == ',') {
+      text++;
+    }
+  }
+  if (speed == 0) {
+    free(speeds);
+    return NULL;
+  }
+  while (n < count) {
+    speeds[n++] = speed;
+  }
+  return speeds;
 }
 
 
@@ -297,30 +1836,100 @@ extern void wake_up(pcb_t *process) {
  * addReadyProcess adds a process to the end of a pseudo linked list (each process
  * struct contains a pointer next that you can use to chain them together)
  * it takes a pointer to a process as an argument and has no return.
- * If using FIFO or static priority scheduling, only one linked list is maintained.
- * If using MLF, maintain 4 linked lists, 1 for each possible priority of a process,
+ * If using FIFO, only one linked list is maintained.
+ * If using MLF, maintain mlf_levels linked lists, 1 for each possible priority of a process,
  * and ready process is added to list that corresponds to its current priority.
+ * Static priority does the same with the 11 static priorities.
  */
 static void addReadyProcess(pcb_t* proc) {
   // ensure no other process can access ready list while we update it
-  pthread_mutex_lock(&ready_mutex);
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
+
+  ready_since[process_index(proc)] = get_simulator_time();
+
+  // EDF orders by deadline, then by when queued
+  if (alg == EarliestDeadline) {
+    jobs[process_index(proc)].seq = queue_seq++;
+  }
+  else if (alg == Stride) {
+    uint64_t* pass = &stride_pass[process_index(proc)];
+    if (*pass < global_pass) {
+      *pass = global_pass;
+    }
+  }
+  enqueue(proc);
+
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+}
+
+/*
+ * enqueue() puts a ready process in the algorithm's queue and wakes an idle
+ * CPU for it, called with ready_mutex held.  addReadyProcess() stamps the
+ * process first; a restored checkpoint has the stamps already.
+ */
+static void enqueue(pcb_t* proc) {
+  // EDF and stride keep their own heap
+  if (alg == EarliestDeadline || alg == Stride) {
+    heap_push(proc);
+  }
+  else if (alg == Lottery) {
+    tree_add(process_index(proc), tickets(proc));
+  }
+  else if (alg == Gang) {
+    // a thread of a gang waits for the others, the last one queues the gang
+    gang_t* gang = &gangs[proc->group];
+    if (proc->group > 0 && ++gang->ready < gang->size) {
+      return;
+    }
+    gang_account();
+    addToList(proc);
+  }
+  else {
+    addToList(proc);
+  }
+
+  /*
+   * Wake an idle CPU for the new process.  This is done for every process,
+   * not just the first into an empty queue: a second process queued before
+   * the first woken CPU gets to run would otherwise leave the other idle
+   * CPUs asleep.  When consolidating, wake them all as another CPU may have
+   * just been unparked, or the one woken may be parked.
+   */
+  ready_count++;
+  if (energy_threshold > 0 &&
+      (ready_count == 1 || ready_count % energy_threshold == 0)) {
+    pthread_cond_broadcast(&ready_empty);
+  }
+  else {
+    pthread_cond_signal(&ready_empty);
+  }
+}
 
-  // for MLF need 4 
+/* addToList() appends a process to its FIFO list, called with ready_mutex held */
+static void addToList(pcb_t* proc) {
+  // for MLF and static priority need one list per level
   pcb_t** curr_head = &head;
   pcb_t** curr_tail = &tail;
 
-  if (alg == MultiLevelFeedback) {
+  if (alg == MultiLevelFeedback || alg == StaticPriority) {
     // Use the appropriate priority queue
-    curr_head = &multi_level_heads[proc->temp_priority];
-    curr_tail = &multi_level_tails[proc->temp_priority];
+    int level = proc->static_priority;
+    if (alg == MultiLevelFeedback) {
+      if (mlf_epoch != NULL) {
+        mlf_boost();
+      }
+      level = mlf_level(proc);
+    }
+    curr_head = &multi_level_heads[level];
+    curr_tail = &multi_level_tails[level];
+    level_nonempty |= (uint64_t)1 << level;
+    level_count[level]++;
   }
 
   // add this process to the end of the ready list
   if (*curr_head == NULL) {
     *curr_head = proc;
     *curr_tail = proc;
-    // if list was empty may need to wake up idle process
-    pthread_cond_signal(&ready_empty);
   }
   else {
     (*curr_tail)->next = proc;
@@ -329,8 +1938,6 @@ static void addReadyProcess(pcb_t* proc) {
 
   // ensure that this proc points to NULL
   proc->next = NULL;
-
-  pthread_mutex_unlock(&ready_mutex);
 }
 
 
@@ -338,105 +1945,135 @@ static void addReadyProcess(pcb_t* proc) {
  * getReadyProcess gets the next process that should be run, depending on the scheduler.
  * all schedulers use their specific method to choose the next process to run, remove it 
  * from the ready queue(s), and return it.
- * takes no arguments, returns NULL if no processes are in ready state.
- * Static priority - chooses by searching single queue for highest priority process
- * MLF - chooses first process in highest priority non-empty queue of the 4 queues.
+ * takes the id of the CPU that will run the process, returns NULL if no
+ * processes are in ready state.
+ * Static priority - chooses first process in highest priority non-empty queue,
+ * or with --aging the queue whose first process has the highest effective priority.
+ * MLF - chooses first process in highest priority non-empty queue of the
+ * mlf_levels queues.
  * FIFO - chooses first process in the single queue.
+ * EDF - takes the process whose current job has the earliest deadline.
+ * Lottery - draws a ticket, stride - takes the process with the lowest pass.
+ * Gang - FIFO, but a gang only goes when there are CPUs for all its threads.
+ * With --affinity or --placement, the first few processes of the chosen queue
+ * are decided between by pick_score().
  */
-static pcb_t* getReadyProcess(void) {
+static pcb_t* getReadyProcess(unsigned int cpu_id) {
   // ensure no other process can access ready list while we update it
-  pthread_mutex_lock(&ready_mutex);
+  STAT_LOCK(&ready_mutex, &ready_mutex_stats);
 
-  if (alg == StaticPriority) {
-    // if list is empty, unlock and return null
-    if (head == NULL) {
-      pthread_mutex_unlock(&ready_mutex);
-      return NULL;
-    }
-
-    pcb_t* curr = head;
-
-    unsigned int highest_priority = curr->static_priority;
-    pcb_t* highest_priority_process = curr;
+  // a CPU parked by --energy-aware runs the idle process
+  if (cpu_id >= active_cpus()) {
+    STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+    return NULL;
+  }
 
-    // Find the process with the highest priority
-    while (curr != NULL) {
-      if (curr->static_priority > highest_priority) {
-        highest_priority = curr->static_priority;
-        highest_priority_process = curr;
+  // EDF - the job with the earliest deadline, stride - the lowest pass
+  if (alg == EarliestDeadline || alg == Stride) {
+    pcb_t* first = heap_size > 0 ? heap_pop() : NULL;
+    if (first != NULL) {
+      ready_count--;
+      if (alg == Stride) {
+        global_pass = stride_pass[process_index(first)];
       }
-      curr = curr->next;
     }
+    STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+    return first;
+  }
 
-	// ** FIX **
-    // If the first process has the highest priority, update head!
-    if (head == highest_priority_process) {
-      head = highest_priority_process->next;
+  // gang - a thread handed to this CPU, or the head of the queue if it fits
+  if (alg == Gang) {
+    gang_account();
+    pcb_t* proc = gang_pick(cpu_id);
+    if (proc == NULL && !cpu_idle[cpu_id]) {
+      cpu_idle[cpu_id] = 1;
+      idle_cpus++;
     }
-    else {
-      pcb_t* prev = head;
-      curr = head->next;
-
-      while (curr != NULL && prev != NULL) {
-        if (curr == highest_priority_process) {
-          // Update linked list
-          prev->next = curr->next;
-
-          if (curr == tail) {
-            // Update tail
-            tail = prev;
-          }
-
-          break;
-        }
-
-        prev = curr;
-        curr = curr->next;
-      }
+    else if (proc != NULL && cpu_idle[cpu_id]) {
+      cpu_idle[cpu_id] = 0;
+      idle_cpus--;
     }
+    STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+    return proc;
+  }
 
-    if (head == NULL) {
-      // Update tail
-      tail = NULL;
+  // lottery - draw a ticket
+  if (alg == Lottery) {
+    pcb_t* winner = total_tickets > 0 ? tree_draw() : NULL;
+    if (winner != NULL) {
+      ready_count--;
     }
+    STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+    return winner;
+  }
 
-    pthread_mutex_unlock(&ready_mutex);
-    return highest_priority_process;
+  pcb_t** curr_head = &head;
+  pcb_t** curr_tail = &tail;
+
+  // for MFL and static priority, find highest priority queue that is not
+  // empty, or arbitrarily choose the lowest priority one if all empty.
+  int level = 0;
+  if (alg == MultiLevelFeedback || alg == StaticPriority) {
+    if (mlf_epoch != NULL) {
+      mlf_boost();
+    }
+    level = best_level();
+    curr_head = &multi_level_heads[level];
+    curr_tail = &multi_level_tails[level];
   }
-  // MLF or FIFO
-  else {
-    pcb_t** curr_head = &head;
-    pcb_t** curr_tail = &tail;
 
-	// for MFL, find highest priority queue that is not empty,
-	// or arbitrarily choose last (lowest priority) if all empty.
-    if (alg == MultiLevelFeedback) {
-      for (int i = 3; i >= 0; i--) {
-        curr_head = &multi_level_heads[i];
-        curr_tail = &multi_level_tails[i];
+  // if queue is empty, unlock and return null
+  if (*curr_head == NULL) {
+    STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+    return NULL;
+  }
 
-        // If this queue isn't empty, it's the one, don't go on!
-        if (*curr_head != NULL) {
-          break;
-        }
+  // with affinity/placement, the best of the first few processes goes first
+  if (affinity || placement) {
+    pcb_t* best_prev = NULL;
+    pcb_t* prev = *curr_head;
+    int best_score = pick_score(*curr_head, cpu_id);
+
+    for (int i = 1; i < AFFINITY_WINDOW && prev->next != NULL &&
+           best_score > 0; i++) {
+      int score = pick_score(prev->next, cpu_id);
+      if (score < best_score) {
+        best_score = score;
+        best_prev = prev;
       }
+      prev = prev->next;
     }
 
-    // if queue is empty, unlock and return null
-    if (*curr_head == NULL) {
-      pthread_mutex_unlock(&ready_mutex);
-      return NULL;
+    if (best_prev != NULL) {
+      pcb_t* chosen = best_prev->next;
+      best_prev->next = chosen->next;
+      if (chosen == *curr_tail) *curr_tail = best_prev;
+      if (alg == MultiLevelFeedback || alg == StaticPriority) {
+        level_count[level]--;
+      }
+      ready_count--;
+      STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+      return chosen;
     }
+  }
 
-    // otherwise, remove first process from queue and return.
-    pcb_t* first = *curr_head;
-    *curr_head = first->next;
-
-    // if there was no next process, list is now empty, set tail to NULL
-    if (*curr_head == NULL) *curr_tail = NULL;
+  // otherwise, remove first process from queue and return.
+  pcb_t* first = *curr_head;
+  *curr_head = first->next;
 
-    pthread_mutex_unlock(&ready_mutex);
-    return first;
+  // if there was no next process, list is now empty, set tail to NULL
+  if (*curr_head == NULL) {
+    *curr_tail = NULL;
+    if (alg == MultiLevelFeedback || alg == StaticPriority) {
+      level_nonempty &= ~((uint64_t)1 << level);
+    }
+  }
+  if (alg == MultiLevelFeedback || alg == StaticPriority) {
+    level_count[level]--;
   }
+
+  ready_count--;
+  STAT_UNLOCK(&ready_mutex, &ready_mutex_stats);
+  return first;
 }
 
@@ -10,6 +10,8 @@
 #ifndef __SCHED_H__
 #define __SCHED_H__
 
+#include <stdio.h>
+
 #include "simOS.h"
 
 /* Functions called from simulator - comments in sched.c */
@@ -19,6 +21,22 @@ extern void yield(unsigned int cpu_id);
 extern void terminate(unsigned int cpu_id);
 extern void wake_up(pcb_t *process);
 
+/* Called by the simulator after its final statistics, to add the scheduler's */
+extern void print_sched_stats(void);
+
+/* For --metrics: how many processes each ready queue holds, see sched.c */
+extern unsigned int sched_queue_depths(unsigned int *depths, unsigned int max);
+
+/*
+ * Checkpoints (see checkpoint.h).  sched_settled() says whether every idle
+ * CPU is done picking up a process, so the scheduler's state is complete;
+ * the simulator waits for it before calling sched_save().  sched_restore()
+ * is called before the CPU threads start.
+ */
+extern int sched_settled(void);
+extern void sched_save(FILE *file);
+extern void sched_restore(FILE *file);
+
 
 /*
  * current[] is an array representing the simulated CPU's.
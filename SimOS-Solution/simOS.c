@@ -12,13 +12,22 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <sys/resource.h>
 
 #include "simOS.h"
 #include "proc.h"
 #include "sched.h"
+#include "lockstat.h"
+#include "workload.h"
+#include "timer.h"
+#include "checkpoint.h"
+#include "branch.h"
+#include "metrics.h"
 
 
 typedef enum {
@@ -33,7 +42,20 @@ typedef struct {
     pcb_t *current;
     simulator_cpu_state_t state;
     pthread_cond_t wakeup;
-    int preemption_timer;
+    pthread_cond_t switched;
+    int switch_done;
+    int quantum_expired;
+    unsigned int switch_overhead;
+    unsigned int speed;
+    unsigned int work_credit;
+    unsigned int busy_ticks;
+    unsigned int run_ticks;     /* busy ticks since the last context switch */
+    unsigned long work_done;
+    unsigned int idle_ticks;
+    unsigned int deep_ticks;
+    unsigned int energy_since;
+    double energy;
+    sim_timer_t quantum;
 } simulator_cpu_data_t;
 
 /* The I/O queue is a simple, FIFO queue using a linked list */
@@ -48,12 +70,82 @@ static io_request *io_queue_head = NULL, *io_queue_tail = NULL;
 static simulator_cpu_data_t *simulator_cpu_data;
 static pthread_t *cpu_thread;
 static pthread_mutex_t simulator_mutex;
-static pthread_cond_t thread_yielded;
+static lock_stats_t simulator_mutex_stats;
 static unsigned int simulator_time = 0;
 static unsigned int processes_terminated = 0;
 static unsigned int cpu_count;
-static unsigned int ready_counter = 0, running_counter = 0, waiting_counter = 0;
+static unsigned long ready_counter = 0, running_counter = 0, waiting_counter = 0;
 static unsigned int context_switches = 0;
+static unsigned int migrations[DOMAIN_LEVELS];
+static unsigned int migration_ticks[DOMAIN_LEVELS];
+static unsigned int overhead_ticks = 0;
+static unsigned int wake_ticks = 0;
+static sim_config_t config = SIM_CONFIG_DEFAULT;
+
+/* whether the run stops at config.checkpoint_at, to save it or branch */
+#define STOPS_AT_CHECKPOINT (config.checkpoint_path != NULL || config.branch)
+static struct timespec wall_start;
+
+/* the live metrics (--metrics), and when they were last updated */
+static sim_metrics_t *metrics = NULL;
+static uint64_t metrics_ns = 0, metrics_time = 0;
+
+/*
+ * How many processes are running and waiting for I/O, kept up to date
+ * where the simulator makes them change: context_switch(), the I/O queue,
+ * creation (next_arrival) and termination.  The rest of the live processes
+ * are ready.  ready_counter etc. add these up over the Gantt lines, lazily:
+ * count_states() is called just before a number changes.  A line shows the
+ * numbers at the start of its tick, so a change counts from next_line on.
+ * All of it is protected by the simulator_mutex.
+ */
+static unsigned int running_now = 0, waiting_now = 0;
+static unsigned int counted_until = 0, next_line = 0;
+
+/*
+ * CPU n is bit n%64 of word n/64.  busy_cpus marks the CPUs that have a
+ * process (set by context_switch(), under the simulator_mutex), so the
+ * supervisor only visits those each tick.  pending_preempts marks the CPUs
+ * force_preempt() has been called on; it is updated atomically, without
+ * the mutex.
+ */
+#define CPU_WORDS ((SIM_MAX_CPUS + 63) / 64)
+#define CPU_BIT(n) ((uint64_t)1 << ((n) % 64))
+static uint64_t busy_cpus[CPU_WORDS];
+static uint64_t pending_preempts[CPU_WORDS];
+static int simulating = -1;     /* the CPU simulate_cpus() is at, or -1 */
+
+/*
+ * Remaining time of each process's current op, indexed by process_index().
+ * Kept here rather than in the op arrays so those can be shared.  Set when
+ * the process is created.
+ */
+static unsigned int *burst_left;
+
+/*
+ * How many ops each process has moved on by since it was created.  A
+ * checkpoint saves this rather than the workload's own state, and takes the
+ * same number of ops again to bring a process back to where it was.
+ */
+static unsigned int *ops_done;
+
+/*
+ * The arrival queue: process indices sorted by arrival time (ties in table
+ * order), and the position of the next process to create.
+ */
+static unsigned int *arrival_order;
+static unsigned int next_arrival = 0;
+
+/*
+ * The timed events - each CPU's time slice, the I/O request at the head of
+ * the queue and the next arrival - are timers in one wheel, run at the
+ * start of each tick.  A timer only raises its flag (quantum_expired,
+ * io_done, arrivals_due); the event itself happens at its usual place in
+ * the tick, so events keep their order.
+ */
+static timer_wheel_t timers;
+static sim_timer_t io_timer, arrival_timer;
+static int io_done = 0, arrivals_due = 0;
 
 static void simulator_supervisor_thread(void);
 static void simulator_cpu_thread(unsigned int cpu_id);
@@ -63,11 +155,27 @@ int nanosleep(const struct timespec *rqtp, struct timespec *rmtp);
 static void print_gantt_header(void);
 static void print_gantt_line(void);static void print_final_stats(void);
 
+static void count_states(void);
+static unsigned int ready_now(void);
 static void simulate_cpus(void);
+static void account_energy(unsigned int cpu_id, unsigned int until);
 static void simulate_process(unsigned int cpu_id, pcb_t *pcb);
+static void cpu_event(unsigned int cpu_id, simulator_cpu_state_t event);
+static void deliver_preemptions(void);
 static void submit_io_request(pcb_t *pcb, unsigned int execution_time);
 static void simulate_io(void);
 static void simulate_creat(void);
+static void build_arrival_queue(void);
+static void arm_arrival_timer(void);
+static void expire_quantum(sim_timer_t *timer);
+static void expire_io(sim_timer_t *timer);
+static void expire_arrival(sim_timer_t *timer);
+static unsigned int first_tick(unsigned int cpu_id);
+static void fast_forward(void);
+static uint64_t workload_fingerprint(void);
+static void save_checkpoint(void);
+static void publish_metrics(int force);
+static void restore_checkpoint(void);
 
 static void* simulator_cpu_thread_func(void *data);
 
@@ -79,11 +187,13 @@ static void* simulator_cpu_thread_func(void *data);
  * many writers or one reader.
  *
  * Its purpose is to protect the state variable of the PCB structures, which
- * is accessed both by the student's code and by print_gantt_line().  We
- * could use a simple mutex, and lock it while calling any student's code,
- * but then the student's code wouldn't get tested for thread-safeness.
- * So we will intentionally let multiple pieces of the student's code run
- * simultaneously.
+ * is accessed both by the student's code and the library.  We could use a
+ * simple mutex, and lock it while calling any student's code, but then the
+ * student's code wouldn't get tested for thread-safeness.  So we will
+ * intentionally let multiple pieces of the student's code run
+ * simultaneously.  (The Gantt chart used to count the processes in each
+ * state here every tick; it now uses the simulator's own counts, see
+ * count_states().)
  *
  * For the student_lock, the IRWL_WRITER should always be locked while
  * student code is executing on a CPU thread.  The IRWL_READER should always be
@@ -93,46 +203,59 @@ typedef struct {
     pthread_mutex_t mutex;
     pthread_cond_t no_writers;
     int writers;
+    lock_stats_t stats;
 } irwl;
 
-#define IRWL_INIT(i) \
+/*
+ * With LOCK_STATS, the IRWL's internal mutex is instrumented.  The reader
+ * holds that mutex for its whole critical section, so hold time covers the
+ * reader's section, and time the reader spends waiting for writers to drain
+ * is counted as contended wait.
+ */
+#define IRWL_INIT(i, name) \
     pthread_mutex_init(&(i).mutex, NULL); \
     pthread_cond_init(&(i).no_writers, NULL); \
-    (i).writers = 0;
+    (i).writers = 0; \
+    lock_stats_register(&(i).stats, name);
 
 #define IRWL_READER_LOCK(i) \
-    pthread_mutex_lock(&(i).mutex); \
+    STAT_LOCK(&(i).mutex, &(i).stats); \
     while ((i).writers > 0) \
-    { pthread_cond_wait(&(i).no_writers, &(i).mutex); }
+    { STAT_COND_BLOCK(&(i).no_writers, &(i).mutex, &(i).stats); }
 
 #define IRWL_READER_UNLOCK(i) \
-    pthread_mutex_unlock(&(i).mutex);
+    STAT_UNLOCK(&(i).mutex, &(i).stats);
 
 #define IRWL_WRITER_LOCK(i) \
-    pthread_mutex_lock(&(i).mutex); \
+    STAT_LOCK(&(i).mutex, &(i).stats); \
     (i).writers++; \
-    pthread_mutex_unlock(&(i).mutex);
+    STAT_UNLOCK(&(i).mutex, &(i).stats);
 
 #define IRWL_WRITER_UNLOCK(i) \
-    pthread_mutex_lock(&(i).mutex); \
+    STAT_LOCK(&(i).mutex, &(i).stats); \
     (i).writers--; \
     if ((i).writers == 0) \
     { pthread_cond_signal(&(i).no_writers); } \
-    pthread_mutex_unlock(&(i).mutex);
+    STAT_UNLOCK(&(i).mutex, &(i).stats);
 
 static irwl student_lock;
 
 
 /* The big initialization function */
-extern void start_simulator(unsigned int new_cpu_count)
+extern void start_simulator(unsigned int new_cpu_count,
+                            const sim_config_t *new_config)
 {
     int n;
 
+    if (new_config != NULL)
+        config = *new_config;
+
     /* Make sure the # of CPUs is reasonable */
     cpu_count = new_cpu_count;
-    if (cpu_count < 1 || cpu_count > 16)
+    if (cpu_count < 1 || cpu_count > SIM_MAX_CPUS)
     {
-        fprintf(stderr, "CPU Count must be an integer from 1 to 16!\n\n");
+        fprintf(stderr, "CPU Count must be an integer from 1 to %d!\n\n",
+                SIM_MAX_CPUS);
         exit(-1);
     }
 
@@ -142,20 +265,49 @@ extern void start_simulator(unsigned int new_cpu_count)
     assert(cpu_thread != NULL);
     simulator_cpu_data = malloc(sizeof(simulator_cpu_data_t) * cpu_count);
     assert(simulator_cpu_data != NULL);
+    burst_left = malloc(sizeof(unsigned int) * process_count);
+    assert(burst_left != NULL);
+    ops_done = calloc(process_count, sizeof(unsigned int));
+    assert(ops_done != NULL);
+    for (n=0; n<process_count; n++)
+        process_table[n].last_cpu = -1;
+    timer_wheel_init(&timers, 0);
+    timer_init(&io_timer, expire_io, 0);
+    timer_init(&arrival_timer, expire_arrival, 0);
+    build_arrival_queue();
+    arm_arrival_timer();
 
     /* Initialize mutexes and condition variables */
     pthread_mutex_init(&simulator_mutex, NULL);
-	pthread_cond_init(&thread_yielded, NULL);
+    lock_stats_register(&simulator_mutex_stats, "simulator_mutex");
     simulator_time = 0;
     for (n=0; n<cpu_count; n++)
     {
         simulator_cpu_data[n].current = NULL;
         simulator_cpu_data[n].state = CPU_IDLE;
-        simulator_cpu_data[n].preemption_timer = -1;
+        simulator_cpu_data[n].quantum_expired = 0;
+        timer_init(&simulator_cpu_data[n].quantum, expire_quantum, n);
+        simulator_cpu_data[n].switch_overhead = 0;
+        simulator_cpu_data[n].speed =
+            config.cpu_speed != NULL ? config.cpu_speed[n] : 100;
+        simulator_cpu_data[n].work_credit = 0;
+        simulator_cpu_data[n].busy_ticks = 0;
+        simulator_cpu_data[n].work_done = 0;
+        simulator_cpu_data[n].idle_ticks = 0;
+        simulator_cpu_data[n].deep_ticks = 0;
+        simulator_cpu_data[n].energy_since = 0;
+        simulator_cpu_data[n].energy = 0.0;
+        simulator_cpu_data[n].switch_done = 0;
         pthread_cond_init(&simulator_cpu_data[n].wakeup, NULL);
+        pthread_cond_init(&simulator_cpu_data[n].switched, NULL);
     }
 
-    IRWL_INIT(student_lock)
+    IRWL_INIT(student_lock, "student_lock")
+
+    if (config.restore_path != NULL)
+        restore_checkpoint();
+    if (config.metrics_name != NULL)
+        metrics = metrics_create(config.metrics_name);
 
     /* Start CPU threads */
     for (n=0; n<cpu_count; n++)
@@ -163,6 +315,7 @@ extern void start_simulator(unsigned int new_cpu_count)
                        (void*)(long)n);
 
     /* Start supervisor thread */
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
     simulator_supervisor_thread();
 }
 
@@ -180,23 +333,44 @@ static void simulator_supervisor_thread(void)
        display a line in the Gantt chart and check for pending I/O requests */
     while (1)
     {
-        pthread_mutex_lock(&simulator_mutex);
+        STAT_LOCK(&simulator_mutex, &simulator_mutex_stats);
 
         /* Exit when all processes terminate */
-        if (processes_terminated >= PROCESS_COUNT)
+        if (processes_terminated >= process_count)
         {
+            if (STOPS_AT_CHECKPOINT)
+                fprintf(stderr, "The run ended at tick %u, before the "
+                        "checkpoint at tick %u\n", simulator_time,
+                        config.checkpoint_at);
+            if (metrics != NULL)
+                publish_metrics(1);
             print_final_stats();
             exit(0);
         }
 
+        /* nothing is running or ready: skip to the next timed event */
+        if (running_now == 0 && ready_now() == 0 && config.tick_usec == 0)
+            fast_forward();
+
+        if (STOPS_AT_CHECKPOINT && simulator_time >= config.checkpoint_at)
+            save_checkpoint();
+
         print_gantt_line();
+        next_line = simulator_time + 1;
+        timer_run(&timers, simulator_time);
         simulate_cpus();
         simulate_io();
         simulate_creat();
+        deliver_preemptions();
         simulator_time++;
-        pthread_mutex_unlock(&simulator_mutex);
+        if (metrics != NULL)
+            publish_metrics(0);
+        STAT_UNLOCK(&simulator_mutex, &simulator_mutex_stats);
 
-        mt_safe_usleep(10);
+        if (config.tick_usec > 0)
+            mt_safe_usleep(config.tick_usec);
+        else
+            sched_yield();
     }
 }
 
@@ -219,7 +393,10 @@ static void simulator_supervisor_thread(void)
  *      variable.
  *
  *   4) Once the CPU thread unblocks, it calls the students event handler,
- *      then goes back to step 1.
+ *      then goes back to step 1.  The handler ends in context_switch(),
+ *      which sets the state back to CPU_RUNNING (or CPU_IDLE) - it has to
+ *      happen there, under the simulator_mutex, or an event the supervisor
+ *      sends before this thread gets back to step 1 would be lost.
  *
  * There is one special case: idle.  Idle is simulated by the student's code,
  * not the library's.  So we simply set the state variable to CPU_IDLE, and
@@ -231,23 +408,12 @@ static void simulator_cpu_thread(unsigned int cpu_id)
 
     while (1)
     {
-        pthread_mutex_lock(&simulator_mutex);
-        if (simulator_cpu_data[cpu_id].current == NULL)
-        {
-            /* the idle process was selected */
-            simulator_cpu_data[cpu_id].state = CPU_IDLE;
-        }
-        else
-        {
-            /* a process was scheduled */
-            simulator_cpu_data[cpu_id].state = CPU_RUNNING;
-
-            while (simulator_cpu_data[cpu_id].state == CPU_RUNNING)
-                pthread_cond_wait(&simulator_cpu_data[cpu_id].wakeup,
-                    &simulator_mutex);
-        }
+        STAT_LOCK(&simulator_mutex, &simulator_mutex_stats);
+        while (simulator_cpu_data[cpu_id].state == CPU_RUNNING)
+            STAT_COND_WAIT(&simulator_cpu_data[cpu_id].wakeup,
+                &simulator_mutex, &simulator_mutex_stats);
         state = simulator_cpu_data[cpu_id].state;
-        pthread_mutex_unlock(&simulator_mutex);
+        STAT_UNLOCK(&simulator_mutex, &simulator_mutex_stats);
 
         /* Call student's code */
         switch (state)
@@ -273,7 +439,6 @@ static void simulator_cpu_thread(unsigned int cpu_id)
             break;
 
         case CPU_TERMINATE:
-            processes_terminated++;
             IRWL_WRITER_LOCK(student_lock)
             terminate(cpu_id);
             IRWL_WRITER_UNLOCK(student_lock)
@@ -296,6 +461,9 @@ static void print_gantt_header(void)
 {
     int n;
 
+    if (config.quiet)
+        return;
+
     printf("Time  Ru Re Wa     ");
     for (n=0; n<cpu_count; n++)
         printf(" CPU %d   ", n);
@@ -309,43 +477,14 @@ static void print_gantt_header(void)
 static void print_gantt_line(void)
 {
     io_request *r;
-    unsigned int current_ready = 0, current_running = 0, current_waiting = 0;
     int n;
 
-
-    /*
-     * Update number of processes in each state.
-     */
-    IRWL_READER_LOCK(student_lock)
-    for (n=0; n<PROCESS_COUNT; n++)
-    {
-        switch(processes[n].state)
-        {
-        case PROCESS_READY:
-            current_ready++;
-            ready_counter++;
-            break;
-
-        case PROCESS_RUNNING:
-            current_running++;
-            running_counter++;
-            break;
-
-        case PROCESS_WAITING:
-            current_waiting++;
-            waiting_counter++;
-            break;
-
-        default:
-            break;
-        }
-    }
-    IRWL_READER_UNLOCK(student_lock)
-
+    if (config.quiet)
+        return;
 
     /* Print time */
-    printf("%-5.1f %-2d %-2d %-2d     ", (float)simulator_time / 10.0,
-        current_running, current_ready, current_waiting);
+    printf("%-5.1f %-2u %-2u %-2u     ", (float)simulator_time / 10.0,
+        running_now, ready_now(), waiting_now);
 
     /* Print running processes */
     for (n=0; n<cpu_count; n++)
@@ -369,10 +508,79 @@ static void print_gantt_line(void)
 
 static void print_final_stats(void)
 {
+    struct timespec wall_end;
+    struct rusage usage;
+    double wall;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    wall = (wall_end.tv_sec - wall_start.tv_sec) +
+        (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    getrusage(RUSAGE_SELF, &usage);
+
     printf("\n\n");
     printf("# of Context Switches: %u\n", context_switches);
     printf("Total execution time: %.1f s\n", (float)simulator_time / 10.0);
+    count_states();
     printf("Total time spent in READY state: %.1f s\n", (float)ready_counter / 10.0);
+    if (config.cpu_speed != NULL)
+    {
+        int n;
+
+        for (n=0; n<cpu_count; n++)
+            printf("CPU %d (speed %u%%): busy %.1f%%, %.1f s of work done\n",
+                   n, simulator_cpu_data[n].speed,
+                   simulator_time > 0 ? 100.0 *
+                   simulator_cpu_data[n].busy_ticks / simulator_time : 0.0,
+                   (float)simulator_cpu_data[n].work_done / 10.0);
+    }
+    if (config.switch_cost > 0 || migration_ticks[DOMAIN_LLC] > 0 ||
+        migration_ticks[DOMAIN_NODE] > 0 || migration_ticks[DOMAIN_SOCKET] > 0 ||
+        migration_ticks[DOMAIN_REMOTE] > 0)
+    {
+        static const char *level_names[DOMAIN_LEVELS] =
+            { "cpu", "same LLC", "same node", "same socket", "remote" };
+        double capacity = (double)cpu_count * simulator_time;
+        unsigned int switching = overhead_ticks - wake_ticks;
+        int level;
+
+        printf("Total CPU time spent switching: %.1f s (%.1f%% of capacity)\n",
+               (float)switching / 10.0,
+               capacity > 0 ? 100.0 * switching / capacity : 0.0);
+        for (level = DOMAIN_LLC; level < DOMAIN_LEVELS; level++)
+            printf("# of Migrations (%s): %u, %.1f s lost (%.1f%% of capacity)\n",
+                   level_names[level], migrations[level],
+                   (float)migration_ticks[level] / 10.0,
+                   capacity > 0 ? 100.0 * migration_ticks[level] / capacity : 0.0);
+    }
+
+    if (config.power.active_watts > 0)
+    {
+        double energy = 0.0, seconds = simulator_time / 10.0;
+        int n;
+
+        for (n=0; n<cpu_count; n++)
+        {
+            account_energy(n, next_line);
+            printf("CPU %d energy: %.1f J, %.1f%% of the time in deep idle\n",
+                   n, simulator_cpu_data[n].energy,
+                   simulator_time > 0 ? 100.0 *
+                   simulator_cpu_data[n].deep_ticks / simulator_time : 0.0);
+            energy += simulator_cpu_data[n].energy;
+        }
+        printf("Total energy: %.1f J (average %.2f W)\n", energy,
+               seconds > 0 ? energy / seconds : 0.0);
+        printf("Energy-delay product: %.1f J*s\n", energy * seconds);
+        printf("Total CPU time spent waking from deep idle: %.1f s\n",
+               (float)wake_ticks / 10.0);
+    }
+
+    /* Simulator throughput, for benchmarking (see bench/) */
+    printf("Wall clock time: %.3f s\n", wall);
+    printf("Simulated ticks per second: %.0f\n", simulator_time / wall);
+    printf("Scheduler decisions per second: %.0f\n", context_switches / wall);
+    printf("Peak RSS: %ld KB\n", usage.ru_maxrss);
+    print_sched_stats();
+    lock_stats_report();
 }
 
 
@@ -381,46 +589,226 @@ static void print_final_stats(void)
  * context_switch() and force_preempt() are the two functions available to
  * student's code.
  */
-extern void context_switch(unsigned int cpu_id, pcb_t *pcb,
-                           int preemption_time)
+extern unsigned int context_switch(unsigned int cpu_id, pcb_t *pcb,
+                                   int preemption_time)
 {
+    unsigned int now;
+
     assert(cpu_id < cpu_count);
-    assert(pcb == NULL || (pcb >= processes && pcb <= processes +
-        PROCESS_COUNT - 1));
+    assert(pcb == NULL || (pcb >= process_table && pcb <= process_table +
+        process_count - 1));
 
     context_switches++;
 
     IRWL_WRITER_UNLOCK(student_lock);
-    pthread_mutex_lock(&simulator_mutex);
+    STAT_LOCK(&simulator_mutex, &simulator_mutex_stats);
+
+    /*
+     * Charge the switch (and migration) cost to the CPU, unless the same
+     * process just keeps running.
+     */
+    if (pcb != NULL && pcb != simulator_cpu_data[cpu_id].current)
+    {
+        simulator_cpu_data[cpu_id].switch_overhead = config.switch_cost;
+        if (pcb->last_cpu >= 0 && (unsigned int)pcb->last_cpu != cpu_id)
+        {
+            domain_level_t level = cpu_distance(pcb->last_cpu, cpu_id);
+            unsigned int cost = config.topology.migration_cost[level];
+
+            simulator_cpu_data[cpu_id].switch_overhead += cost;
+            migrations[level]++;
+            migration_ticks[level] += cost;
+        }
+    }
+    else if (pcb == NULL)
+        simulator_cpu_data[cpu_id].switch_overhead = 0;
+
+    /*
+     * Charge the energy used since the CPU last went busy or idle, and
+     * count the processes running.
+     */
+    if ((pcb == NULL) != (simulator_cpu_data[cpu_id].current == NULL))
+    {
+        if (config.power.active_watts > 0)
+            account_energy(cpu_id, first_tick(cpu_id));
+        count_states();
+        if (pcb != NULL)
+        {
+            running_now++;
+            busy_cpus[cpu_id / 64] |= CPU_BIT(cpu_id);
+        }
+        else
+        {
+            running_now--;
+            busy_cpus[cpu_id / 64] &= ~CPU_BIT(cpu_id);
+        }
+    }
+
+    /* a CPU coming out of deep idle has to power up first */
+    if (pcb != NULL && simulator_cpu_data[cpu_id].current == NULL &&
+        config.power.deep_after > 0 &&
+        simulator_cpu_data[cpu_id].idle_ticks >= config.power.deep_after)
+    {
+        simulator_cpu_data[cpu_id].switch_overhead +=
+            config.power.wake_latency;
+        wake_ticks += config.power.wake_latency;
+    }
+    if (pcb != NULL)
+        pcb->last_cpu = cpu_id;
+    if (pcb != simulator_cpu_data[cpu_id].current)
+        simulator_cpu_data[cpu_id].work_credit = 0;
+    simulator_cpu_data[cpu_id].run_ticks = 0;
+
     simulator_cpu_data[cpu_id].current = pcb;
-    simulator_cpu_data[cpu_id].preemption_timer = preemption_time;
-	pthread_cond_signal(&thread_yielded);
-    pthread_mutex_unlock(&simulator_mutex);
+
+    /* the time slice starts once the switch overhead has been paid */
+    simulator_cpu_data[cpu_id].quantum_expired = 0;
+    if (pcb != NULL && preemption_time > 0)
+        timer_add(&timers, &simulator_cpu_data[cpu_id].quantum,
+                  first_tick(cpu_id) + simulator_cpu_data[cpu_id].switch_overhead
+                  + preemption_time - 1);
+    else
+        timer_cancel(&timers, &simulator_cpu_data[cpu_id].quantum);
+    simulator_cpu_data[cpu_id].state = pcb != NULL ? CPU_RUNNING : CPU_IDLE;
+
+    /* only the supervisor waiting on this CPU needs to know */
+    simulator_cpu_data[cpu_id].switch_done = 1;
+    pthread_cond_signal(&simulator_cpu_data[cpu_id].switched);
+    now = simulator_time;
+    STAT_UNLOCK(&simulator_mutex, &simulator_mutex_stats);
     IRWL_WRITER_LOCK(student_lock);
+    return now;
 }
 
-extern void force_preempt(unsigned int cpu_id)
+extern domain_level_t cpu_distance(unsigned int cpu_a, unsigned int cpu_b)
+{
+    sim_topology_t *t = &config.topology;
+    unsigned int llc_a, llc_b, node_a, node_b;
+
+    if (cpu_a == cpu_b)
+        return DOMAIN_CPU;
+    if (t->cpus_per_llc == 0)
+        return DOMAIN_LLC;
+    llc_a = cpu_a / t->cpus_per_llc;
+    llc_b = cpu_b / t->cpus_per_llc;
+    if (llc_a == llc_b || t->llcs_per_node == 0)
+        return DOMAIN_LLC;
+    node_a = llc_a / t->llcs_per_node;
+    node_b = llc_b / t->llcs_per_node;
+    if (node_a == node_b)
+        return DOMAIN_NODE;
+    if (t->nodes_per_socket == 0 ||
+        node_a / t->nodes_per_socket == node_b / t->nodes_per_socket)
+        return DOMAIN_SOCKET;
+    return DOMAIN_REMOTE;
+}
+
+extern unsigned int cpu_speed(unsigned int cpu_id)
 {
     assert(cpu_id < cpu_count);
+    return simulator_cpu_data[cpu_id].speed;
+}
 
-    IRWL_WRITER_UNLOCK(student_lock);
-    pthread_mutex_lock(&simulator_mutex);
+/*
+ * The supervisor is waiting in cpu_event() for this CPU's handler, and it
+ * updated run_ticks before handing the event over under the mutex.
+ */
+extern unsigned int cpu_run_ticks(unsigned int cpu_id)
+{
+    assert(cpu_id < cpu_count);
+    return simulator_cpu_data[cpu_id].run_ticks;
+}
 
-    /*
-     * It is possible that the student's code calls force_preempt() at the
-     * same time the process was already going to yield or terminate.  We
-     * check for that case by only preempting if the CPU is set to CPU_RUNNING.
-     */
-    if (simulator_cpu_data[cpu_id].state == CPU_RUNNING)
+extern unsigned int get_simulator_time(void)
+{
+    return simulator_time;
+}
+
+extern int parse_topology(const char *spec, sim_topology_t *topology)
+{
+    char *copy = strdup(spec), *item, *save, *value;
+    unsigned int *cost = topology->migration_cost;
+    int result = 0;
+
+    for (item = strtok_r(copy, ",", &save); item != NULL && result == 0;
+         item = strtok_r(NULL, ",", &save))
     {
-        simulator_cpu_data[cpu_id].state = CPU_PREEMPT;
-        pthread_cond_signal(&simulator_cpu_data[cpu_id].wakeup);
-		// wait to make sure thread finishes preempt and context switch
-		pthread_cond_wait(&thread_yielded, &simulator_mutex);
+        value = strchr(item, '=');
+        if (value == NULL)
+        {
+            result = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        if (strcmp(item, "llc") == 0)
+            topology->cpus_per_llc = atoi(value);
+        else if (strcmp(item, "node") == 0)
+            topology->llcs_per_node = atoi(value);
+        else if (strcmp(item, "socket") == 0)
+            topology->nodes_per_socket = atoi(value);
+        else if (strcmp(item, "cost") != 0 ||
+                 sscanf(value, "%u:%u:%u:%u", &cost[DOMAIN_LLC],
+                        &cost[DOMAIN_NODE], &cost[DOMAIN_SOCKET],
+                        &cost[DOMAIN_REMOTE]) != 4)
+            result = -1;
     }
+    free(copy);
+    return result;
+}
 
-    pthread_mutex_unlock(&simulator_mutex);
-    IRWL_WRITER_LOCK(student_lock);
+extern int parse_power(const char *spec, sim_power_t *power)
+{
+    char *copy = strdup(spec), *item, *save, *value, *end;
+    int result = 0;
+
+    for (item = strtok_r(copy, ",", &save); item != NULL && result == 0;
+         item = strtok_r(NULL, ",", &save))
+    {
+        double number;
+
+        value = strchr(item, '=');
+        if (value == NULL)
+        {
+            result = -1;
+            break;
+        }
+        *value++ = '\0';
+        number = strtod(value, &end);
+        if (end == value || *end != '\0' || number < 0)
+        {
+            result = -1;
+            break;
+        }
+
+        if (strcmp(item, "active") == 0)
+            power->active_watts = number;
+        else if (strcmp(item, "idle") == 0)
+            power->idle_watts = number;
+        else if (strcmp(item, "deep") == 0)
+            power->deep_watts = number;
+        else if (strcmp(item, "deep-after") == 0)
+            power->deep_after = (unsigned int)number;
+        else if (strcmp(item, "wake") == 0)
+            power->wake_latency = (unsigned int)number;
+        else
+            result = -1;
+    }
+    free(copy);
+    return result;
+}
+
+/*
+ * force_preempt() only posts the request, like an inter-processor interrupt:
+ * the caller doesn't take the simulator_mutex or wait for the switch.  The
+ * supervisor delivers it at the end of the tick, see deliver_preemptions().
+ */
+extern void force_preempt(unsigned int cpu_id)
+{
+    assert(cpu_id < cpu_count);
+
+    __atomic_fetch_or(&pending_preempts[cpu_id / 64], CPU_BIT(cpu_id),
+                      __ATOMIC_RELEASE);
 }
 
 
@@ -437,20 +825,142 @@ extern void force_preempt(unsigned int cpu_id)
  *   calls wake_up() upon completion.
  *
  * simulate_creat() simulates initial process creation by calling the
- *   student's wake_up().
+ *   student's wake_up() once a process's arrival time is reached.
  */
 
+/*
+ * Only the busy CPUs are visited, in order.  The word is read again after
+ * each one, as an idle CPU may pick up a process while the simulator_mutex
+ * is released for another CPU's event; it runs this tick if it comes later.
+ */
 static void simulate_cpus(void)
 {
-    int n;
+    unsigned int w, n;
+    uint64_t bits, done;
 
-    for (n=0; n<cpu_count; n++)
+    for (w=0; w<(cpu_count + 63) / 64; w++)
     {
-        if (simulator_cpu_data[n].current != NULL)
+        for (bits = busy_cpus[w]; bits != 0; bits = busy_cpus[w] & ~done)
+        {
+            n = __builtin_ctzll(bits);
+            done = (CPU_BIT(n) << 1) - 1;
+            n += w * 64;
+            simulating = n;
             simulate_process(n, simulator_cpu_data[n].current);
+        }
+    }
+    simulating = -1;
+}
+
+/*
+ * cpu_event() hands an event to a CPU thread and waits until its handler
+ * has called context_switch().  Each CPU has its own completion flag and
+ * condition variable, so a switch on one CPU never wakes a wait on another.
+ * A preemption still pending for the CPU was meant for the process that is
+ * leaving it now, so it is dropped.
+ */
+static void cpu_event(unsigned int cpu_id, simulator_cpu_state_t event)
+{
+    simulator_cpu_data_t *cpu = &simulator_cpu_data[cpu_id];
+
+    __atomic_fetch_and(&pending_preempts[cpu_id / 64], ~CPU_BIT(cpu_id),
+                       __ATOMIC_RELAXED);
+    cpu->switch_done = 0;
+    cpu->state = event;
+    pthread_cond_signal(&cpu->wakeup);
+    while (!cpu->switch_done)
+        STAT_COND_WAIT(&cpu->switched, &simulator_mutex,
+            &simulator_mutex_stats);
+}
+
+/*
+ * deliver_preemptions() runs at the end of each tick and preempts every CPU
+ * that force_preempt() was called on during it.  All the wake_up()s of the
+ * tick have queued their processes by then, so each preempt() sees them.
+ * A request for a CPU that has gone idle, or whose process already yielded
+ * or terminated, is dropped.
+ */
+static void deliver_preemptions(void)
+{
+    unsigned int w, n;
+    uint64_t bits;
+
+    for (w=0; w<(cpu_count + 63) / 64; w++)
+    {
+        if (pending_preempts[w] == 0)
+            continue;
+        bits = __atomic_exchange_n(&pending_preempts[w], 0, __ATOMIC_ACQ_REL);
+        for (; bits != 0; bits &= bits - 1)
+        {
+            n = w * 64 + __builtin_ctzll(bits);
+            if (simulator_cpu_data[n].state == CPU_RUNNING &&
+                simulator_cpu_data[n].current != NULL)
+                cpu_event(n, CPU_PREEMPT);
+        }
     }
 }
 
+/* add the current numbers of processes in each state up to next_line */
+static void count_states(void)
+{
+    unsigned long lines = next_line - counted_until;
+
+    if (lines == 0)
+        return;
+    running_counter += lines * running_now;
+    waiting_counter += lines * waiting_now;
+    ready_counter += lines * ready_now();
+    counted_until = next_line;
+}
+
+/* the live processes that are neither running nor waiting for I/O */
+static unsigned int ready_now(void)
+{
+    return next_arrival - processes_terminated - running_now - waiting_now;
+}
+
+/*
+ * account_energy() charges a CPU the energy of the ticks since it was last
+ * charged, up to (not including) tick until, all spent in its current
+ * state: busy, or idle and after deep_after ticks in deep idle.  Called when
+ * the CPU goes busy or idle, and at the end.
+ */
+static void account_energy(unsigned int cpu_id, unsigned int until)
+{
+    simulator_cpu_data_t *cpu = &simulator_cpu_data[cpu_id];
+    sim_power_t *power = &config.power;
+    unsigned int ticks = until - cpu->energy_since;
+    unsigned int shallow = ticks;
+    double joules;
+
+    cpu->energy_since = until;
+    if (ticks == 0)
+        return;
+
+    if (cpu->current != NULL)
+    {
+        double f = cpu->speed / 100.0;
+
+        joules = (power->idle_watts +
+            (power->active_watts - power->idle_watts) * f * f * f) * ticks;
+        cpu->idle_ticks = 0;
+    }
+    else
+    {
+        if (power->deep_after > 0)
+            shallow = cpu->idle_ticks >= power->deep_after ? 0 :
+                power->deep_after - cpu->idle_ticks < ticks ?
+                power->deep_after - cpu->idle_ticks : ticks;
+        joules = power->idle_watts * shallow +
+            power->deep_watts * (ticks - shallow);
+        cpu->idle_ticks += shallow;
+        cpu->deep_ticks += ticks - shallow;
+    }
+
+    /* a tick is 1/10th of a second */
+    cpu->energy += joules / 10.0;
+}
+
 static void simulate_process(unsigned int cpu_id, pcb_t *pcb)
 {
     /*
@@ -458,6 +968,18 @@ static void simulate_process(unsigned int cpu_id, pcb_t *pcb)
      * in the operations array
      */
     op_t *pc = (op_t*)pcb->pc;
+    unsigned int *left = &burst_left[process_index(pcb)];
+
+    /*
+     * The CPU is still switching to this process - the burst doesn't
+     * progress and the time slice doesn't run down.
+     */
+    if (simulator_cpu_data[cpu_id].switch_overhead > 0 && pc->type == OP_CPU)
+    {
+        simulator_cpu_data[cpu_id].switch_overhead--;
+        overhead_ticks++;
+        return;
+    }
 
     switch (pc->type)
     {
@@ -465,27 +987,39 @@ static void simulate_process(unsigned int cpu_id, pcb_t *pcb)
         /* Scheduling a running process ... good ... */
 
         /* Check to see if the CPU burst has completed */
-        if (pc->time > 0)
+        if (*left > 0)
         {
-            /* Simulate running the process */
-            pc->time--;
+            simulator_cpu_data_t *cpu = &simulator_cpu_data[cpu_id];
 
-            /* Simulate the preemption timer */
-            simulator_cpu_data[cpu_id].preemption_timer--;
-            if (simulator_cpu_data[cpu_id].preemption_timer == 0)
+            /*
+             * Simulate running the process - the CPU retires speed/100
+             * ticks of the burst per tick, carrying fractions over.
+             */
+            cpu->busy_ticks++;
+            cpu->run_ticks++;
+            cpu->work_credit += cpu->speed;
+            while (cpu->work_credit >= 100 && *left > 0)
+            {
+                (*left)--;
+                cpu->work_credit -= 100;
+                cpu->work_done++;
+            }
+            if (*left == 0)
+                cpu->work_credit = 0;
+
+            /* Check the preemption timer */
+            if (cpu->quantum_expired)
             {
                 /* The timer has expired; preempt the running process */
-                simulator_cpu_data[cpu_id].state = CPU_PREEMPT;
-                pthread_cond_signal(&simulator_cpu_data[cpu_id].wakeup);
-				// wait to make sure thread finishes preempt and context switch
-				pthread_cond_wait(&thread_yielded, &simulator_mutex);
+                cpu_event(cpu_id, CPU_PREEMPT);
             }
         }
         else
         {
             /* Move to the next operation */
-            pcb->pc=((op_t*)(pcb->pc))+1;
-			pc++;
+            pc = workload_next_op(pcb);
+            *left = pc->time;
+            ops_done[process_index(pcb)]++;
 
             switch (pc->type)
             {
@@ -494,18 +1028,14 @@ static void simulate_process(unsigned int cpu_id, pcb_t *pcb)
                 submit_io_request(pcb, pc->time);
 
                 /* Generate a yield() call on the appropriate CPU */
-                simulator_cpu_data[cpu_id].state = CPU_YIELD;
-                pthread_cond_signal(&simulator_cpu_data[cpu_id].wakeup);
-				// wait to make sure thread finishes yield and context switch
-				pthread_cond_wait(&thread_yielded, &simulator_mutex);
+                cpu_event(cpu_id, CPU_YIELD);
                 break;
 
             case OP_TERMINATE:
                 /* Generate a terminate() call on the appropriate CPU */
-                simulator_cpu_data[cpu_id].state = CPU_TERMINATE;
-                pthread_cond_signal(&simulator_cpu_data[cpu_id].wakeup);
-				// wait to make sure thread finishes terminate and context switch
-				pthread_cond_wait(&thread_yielded, &simulator_mutex);
+                count_states();
+                processes_terminated++;
+                cpu_event(cpu_id, CPU_TERMINATE);
                 break;
 
             case OP_CPU:
@@ -536,6 +1066,12 @@ static void submit_io_request(pcb_t *pcb, unsigned int execution_time)
     r->pcb = pcb;
     r->execution_time = execution_time;
     r->next = NULL;
+    count_states();
+    waiting_now++;
+
+    /* The head of the queue makes progress from this tick on */
+    if (io_queue_head == NULL)
+        timer_add(&timers, &io_timer, simulator_time + execution_time);
 
     /* Add request to end of queue */
     if (io_queue_tail != NULL)
@@ -552,55 +1088,479 @@ static void submit_io_request(pcb_t *pcb, unsigned int execution_time)
 
 static void simulate_io(void)
 {
+    io_request *completed = io_queue_head;
+    pcb_t *pcb;
+
+    if (!io_done)
+        return; /* The I/O request at the head isn't done yet */
+    io_done = 0;
+
+    /* Move the programs "PC" to the next "instruction" */
+    burst_left[process_index(completed->pcb)] =
+        workload_next_op(completed->pcb)->time;
+    ops_done[process_index(completed->pcb)]++;
+
+    /*
+     * Remove the I/O request from the queue before calling the student's
+     * code.  We must do this, because once we release the simulator_mutex,
+     * the I/O queue may have changed.
+     */
+    pcb = completed->pcb;
+    io_queue_head = completed->next;
     if (io_queue_head == NULL)
-        return; /* There are no I/O requests */
+        io_queue_tail = NULL;
+    free(completed);
+    count_states();
+    waiting_now--;
+
+    /* the next request starts on the next tick */
+    if (io_queue_head != NULL)
+        timer_add(&timers, &io_timer,
+                  simulator_time + 1 + io_queue_head->execution_time);
+
+    /* Call the student's wake_up() handler */
+    STAT_UNLOCK(&simulator_mutex, &simulator_mutex_stats);
+    IRWL_WRITER_LOCK(student_lock);
+    wake_up(pcb);
+    IRWL_WRITER_UNLOCK(student_lock);
+    STAT_LOCK(&simulator_mutex, &simulator_mutex_stats);
+}
 
-    if (io_queue_head->execution_time-- <= 0)
-    {
-        io_request *completed = io_queue_head;
-        pcb_t *pcb;
+static int compare_arrivals(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+    unsigned int ax = workload_arrival(x), ay = workload_arrival(y);
 
-        /* Move the programs "PC" to the next "instruction" */
-        completed->pcb->pc = ((op_t*)completed->pcb->pc) + 1;
-        
-        /*
-         * Remove the I/O request from the queue before calling the student's
-         * code.  We must do this, because once we release the simulator_mutex,
-         * the I/O queue may have changed.
-         */
-        pcb = completed->pcb;
-        io_queue_head = completed->next;
-        if (io_queue_head == NULL)
-            io_queue_tail = NULL;
-        free(completed);
+    if (ax != ay)
+        return ax < ay ? -1 : 1;
+    return x < y ? -1 : (x > y);
+}
 
-        /* Call the student's wake_up() handler */
-        pthread_mutex_unlock(&simulator_mutex);
-        IRWL_WRITER_LOCK(student_lock);
-        wake_up(pcb);
-        IRWL_WRITER_UNLOCK(student_lock);
-        pthread_mutex_lock(&simulator_mutex);
+/*
+ * Sort the processes by arrival time.  Generated arrivals are already in
+ * order, so the sort is skipped when it isn't needed.
+ */
+static void build_arrival_queue(void)
+{
+    unsigned int n;
+    int sorted = 1;
+
+    arrival_order = malloc(sizeof(unsigned int) * process_count);
+    assert(arrival_order != NULL);
+    for (n=0; n<process_count; n++)
+    {
+        arrival_order[n] = n;
+        if (n > 0 && workload_arrival(n) < workload_arrival(n-1))
+            sorted = 0;
     }
+    if (!sorted)
+        qsort(arrival_order, process_count, sizeof(unsigned int),
+              compare_arrivals);
 }
 
-/* Add a new process every 10 timesteps until all processes have been started */
+/*
+ * Start every process whose arrival time has come.  By default that is a new
+ * process every 10 timesteps until all processes have been started.  All
+ * arrivals due in one tick are handed to the student's code as one batch,
+ * under a single acquisition of the locks.
+ */
 static void simulate_creat(void)
 {
-    static int processes_created = 0;
+    unsigned int first = next_arrival;
+
+    if (!arrivals_due)
+        return;
+    arrivals_due = 0;
 
-    if ((simulator_time % 10) == 0 && processes_created < PROCESS_COUNT)
+    count_states();
+    while (next_arrival < process_count &&
+           workload_arrival(arrival_order[next_arrival]) <= simulator_time)
     {
-        /* Call student's wake_up() handler */
-        pthread_mutex_unlock(&simulator_mutex);
-        IRWL_WRITER_LOCK(student_lock);
-        wake_up(&processes[processes_created]);
-        IRWL_WRITER_UNLOCK(student_lock);
-        pthread_mutex_lock(&simulator_mutex);
+        pcb_t *pcb = &process_table[arrival_order[next_arrival++]];
+        burst_left[process_index(pcb)] = workload_start(pcb)->time;
+    }
+    arm_arrival_timer();
+
+    /* Call student's wake_up() handler */
+    STAT_UNLOCK(&simulator_mutex, &simulator_mutex_stats);
+    IRWL_WRITER_LOCK(student_lock);
+    for (; first < next_arrival; first++)
+        wake_up(&process_table[arrival_order[first]]);
+    IRWL_WRITER_UNLOCK(student_lock);
+    STAT_LOCK(&simulator_mutex, &simulator_mutex_stats);
+}
+
+/* arm the arrival timer for the next process still to be created, if any */
+static void arm_arrival_timer(void)
+{
+    if (next_arrival < process_count)
+        timer_add(&timers, &arrival_timer,
+                  workload_arrival(arrival_order[next_arrival]));
+}
 
-        processes_created++;
+static void expire_quantum(sim_timer_t *timer)
+{
+    simulator_cpu_data[timer->arg].quantum_expired = 1;
+}
+
+static void expire_io(sim_timer_t *timer)
+{
+    io_done = 1;
+}
+
+static void expire_arrival(sim_timer_t *timer)
+{
+    arrivals_due = 1;
+}
+
+/*
+ * The first tick a CPU is simulated in after a context switch now: this
+ * one if simulate_cpus() has yet to reach the CPU, otherwise the next.
+ */
+static unsigned int first_tick(unsigned int cpu_id)
+{
+    return simulating >= 0 && cpu_id > (unsigned int)simulating ?
+        simulator_time : next_line;
+}
+
+/*
+ * fast_forward() moves the clock straight to the next timed event, for
+ * when no process is running or ready and so nothing else can happen
+ * before it.  The Gantt chart still gets a line for each tick skipped.
+ */
+static void fast_forward(void)
+{
+    unsigned int next = timer_next(&timers);
+
+    /* stop at the checkpoint, if it comes first */
+    if (STOPS_AT_CHECKPOINT && simulator_time <= config.checkpoint_at &&
+        next > config.checkpoint_at)
+        next = config.checkpoint_at;
+    if (next == TIMER_NONE || next <= simulator_time)
+        return;
+    if (config.quiet)
+        simulator_time = next;
+    else
+        for (; simulator_time < next; simulator_time++)
+            print_gantt_line();
+}
+
+
+
+/*
+ * Checkpoints - see checkpoint.h.  A checkpoint is taken at the start of a
+ * tick, before its Gantt line, so the timed events of earlier ticks have all
+ * happened and the flags they raise are clear.  The simulator's part is its
+ * counters, each created process's state and position in its ops, each
+ * CPU, and the I/O queue; the timers are saved as the ticks they are due.
+ */
+typedef struct {
+    process_state_t state;
+    unsigned int temp_priority;
+    int last_cpu;
+    unsigned int burst_left;
+    unsigned int ops_done;
+    op_type op;                 /* to check the workload is the same */
+} saved_process_t;
+
+typedef struct {
+    int current;                /* process index, or -1 if idle */
+    int quantum_expired;
+    unsigned int switch_overhead;
+    unsigned int work_credit;
+    unsigned int busy_ticks;
+    unsigned int run_ticks;
+    unsigned long work_done;
+    unsigned int idle_ticks;
+    unsigned int deep_ticks;
+    unsigned int energy_since;
+    double energy;
+    unsigned int quantum;       /* when the time slice ends, or TIMER_NONE */
+} saved_cpu_t;
+
+typedef struct {
+    unsigned int process;
+    unsigned int execution_time;
+} saved_io_t;
+
+static const checkpoint_var_t simulator_vars[] = {
+    CHECKPOINT_VAR(simulator_time),
+    CHECKPOINT_VAR(processes_terminated),
+    CHECKPOINT_VAR(ready_counter),
+    CHECKPOINT_VAR(running_counter),
+    CHECKPOINT_VAR(waiting_counter),
+    CHECKPOINT_VAR(context_switches),
+    CHECKPOINT_VAR(migrations),
+    CHECKPOINT_VAR(migration_ticks),
+    CHECKPOINT_VAR(overhead_ticks),
+    CHECKPOINT_VAR(wake_ticks),
+    CHECKPOINT_VAR(running_now),
+    CHECKPOINT_VAR(waiting_now),
+    CHECKPOINT_VAR(counted_until),
+    CHECKPOINT_VAR(next_line),
+    CHECKPOINT_VAR(next_arrival),
+};
+
+#define SIMULATOR_VARS (sizeof(simulator_vars) / sizeof(simulator_vars[0]))
+
+/* a hash of the processes, so a checkpoint isn't restored on another workload */
+static uint64_t workload_fingerprint(void)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    unsigned int n, i;
+
+    for (n=0; n<process_count; n++)
+    {
+        pcb_t *pcb = &process_table[n];
+        unsigned int fields[] = { pcb->static_priority, workload_arrival(n),
+                                  pcb->period, pcb->deadline, pcb->group };
+        const unsigned char *p;
+
+        for (p = (const unsigned char*)pcb->name; *p != '\0'; p++)
+            hash = (hash ^ *p) * 0x100000001b3ull;
+        for (i=0; i<sizeof(fields)/sizeof(fields[0]); i++)
+            hash = (hash ^ fields[i]) * 0x100000001b3ull;
     }
+    return hash;
 }
 
+/*
+ * save_checkpoint() writes the checkpoint, or with config.branch runs the
+ * branches from it, and ends the run.  It is called
+ * by the supervisor with the simulator_mutex held.  A CPU that was idle may
+ * still be switching to a process it took from the ready queue, so first
+ * the mutex is let go until the scheduler says every CPU has settled.
+ */
+static void save_checkpoint(void)
+{
+    unsigned int n, count = 0;
+    uint64_t fingerprint = workload_fingerprint();
+    io_request *r;
+    FILE *file;
+
+    while (!sched_settled())
+    {
+        STAT_UNLOCK(&simulator_mutex, &simulator_mutex_stats);
+        sched_yield();
+        STAT_LOCK(&simulator_mutex, &simulator_mutex_stats);
+    }
+    assert(!io_done && !arrivals_due);
+    for (n=0; n<CPU_WORDS; n++)
+        assert(pending_preempts[n] == 0);
+
+    if (config.branch)
+        file = checkpoint_create_temp();
+    else
+        file = checkpoint_create(config.checkpoint_path);
+    checkpoint_section(file, "SIM ");
+    checkpoint_write(file, &cpu_count, sizeof(cpu_count));
+    checkpoint_write(file, &process_count, sizeof(process_count));
+    checkpoint_write(file, &fingerprint, sizeof(fingerprint));
+    checkpoint_write_vars(file, simulator_vars, SIMULATOR_VARS);
+
+    checkpoint_section(file, "PROC");
+    for (n=0; n<next_arrival; n++)
+    {
+        unsigned int i = arrival_order[n];
+        pcb_t *pcb = &process_table[i];
+        saved_process_t saved = {
+            .state = pcb->state, .temp_priority = pcb->temp_priority,
+            .last_cpu = pcb->last_cpu, .burst_left = burst_left[i],
+            .ops_done = ops_done[i], .op = pcb->pc->type };
+
+        checkpoint_write(file, &saved, sizeof(saved));
+    }
+
+    checkpoint_section(file, "CPUS");
+    for (n=0; n<cpu_count; n++)
+    {
+        simulator_cpu_data_t *cpu = &simulator_cpu_data[n];
+        saved_cpu_t saved = {
+            .current = cpu->current != NULL ?
+                (int)process_index(cpu->current) : -1,
+            .quantum_expired = cpu->quantum_expired,
+            .switch_overhead = cpu->switch_overhead,
+            .work_credit = cpu->work_credit, .busy_ticks = cpu->busy_ticks,
+            .run_ticks = cpu->run_ticks,
+            .work_done = cpu->work_done, .idle_ticks = cpu->idle_ticks,
+            .deep_ticks = cpu->deep_ticks, .energy_since = cpu->energy_since,
+            .energy = cpu->energy,
+            .quantum = timer_pending(&cpu->quantum) ?
+                cpu->quantum.expires : TIMER_NONE };
+
+        checkpoint_write(file, &saved, sizeof(saved));
+    }
+
+    checkpoint_section(file, "IOQ ");
+    for (r = io_queue_head; r != NULL; r = r->next)
+        count++;
+    checkpoint_write(file, &count, sizeof(count));
+    for (r = io_queue_head; r != NULL; r = r->next)
+    {
+        saved_io_t saved = { process_index(r->pcb), r->execution_time };
+        checkpoint_write(file, &saved, sizeof(saved));
+    }
+    n = timer_pending(&io_timer) ? io_timer.expires : TIMER_NONE;
+    checkpoint_write(file, &n, sizeof(n));
+
+    checkpoint_section(file, "SCHD");
+    sched_save(file);
+    if (config.branch)
+    {
+        checkpoint_flush(file);
+        exit(branch_run(file, simulator_time) == 0 ? 0 : -1);
+    }
+    checkpoint_close(file);
+
+    printf("\nCheckpoint of tick %u written to %s\n", simulator_time,
+           config.checkpoint_path);
+    exit(0);
+}
+
+/*
+ * restore_checkpoint() puts the simulator back in the state saved, and has
+ * the scheduler restore its own.  Called from start_simulator() once
+ * everything is set up for tick 0, before the CPU threads start.
+ */
+static void restore_checkpoint(void)
+{
+    FILE *file = checkpoint_open(config.restore_path);
+    unsigned int saved_cpus, saved_processes, n, count, expires;
+    uint64_t fingerprint;
+
+    checkpoint_expect(file, "SIM ");
+    checkpoint_read(file, &saved_cpus, sizeof(saved_cpus));
+    checkpoint_read(file, &saved_processes, sizeof(saved_processes));
+    checkpoint_read(file, &fingerprint, sizeof(fingerprint));
+    if (saved_cpus != cpu_count)
+        checkpoint_fail("checkpoint of a run on a different number of CPUs");
+    if (saved_processes != process_count ||
+        fingerprint != workload_fingerprint())
+        checkpoint_fail("checkpoint of a run with a different workload");
+    checkpoint_read_vars(file, simulator_vars, SIMULATOR_VARS);
+    timer_cancel(&timers, &arrival_timer);      /* armed for tick 0's run */
+    timer_wheel_init(&timers, simulator_time);
+
+    /* take each process's ops again, up to where it was */
+    checkpoint_expect(file, "PROC");
+    for (n=0; n<next_arrival; n++)
+    {
+        unsigned int i = arrival_order[n], k;
+        pcb_t *pcb = &process_table[i];
+        saved_process_t saved;
+        op_t *op = workload_start(pcb);
+
+        checkpoint_read(file, &saved, sizeof(saved));
+        for (k=0; k<saved.ops_done && op->type != OP_TERMINATE; k++)
+            op = workload_next_op(pcb);
+        if (k < saved.ops_done || op->type != saved.op)
+            checkpoint_fail("the workload's ops aren't the ones checkpointed");
+        pcb->state = saved.state;
+        pcb->temp_priority = saved.temp_priority;
+        pcb->last_cpu = saved.last_cpu;
+        burst_left[i] = saved.burst_left;
+        ops_done[i] = saved.ops_done;
+    }
+    arm_arrival_timer();
+
+    checkpoint_expect(file, "CPUS");
+    for (n=0; n<cpu_count; n++)
+    {
+        simulator_cpu_data_t *cpu = &simulator_cpu_data[n];
+        saved_cpu_t saved;
+
+        checkpoint_read(file, &saved, sizeof(saved));
+        if (saved.current >= (int)process_count)
+            checkpoint_fail("corrupt checkpoint");
+        cpu->current = saved.current >= 0 ?
+            &process_table[saved.current] : NULL;
+        cpu->state = cpu->current != NULL ? CPU_RUNNING : CPU_IDLE;
+        if (cpu->current != NULL)
+            busy_cpus[n / 64] |= CPU_BIT(n);
+        cpu->quantum_expired = saved.quantum_expired;
+        cpu->switch_overhead = saved.switch_overhead;
+        cpu->work_credit = saved.work_credit;
+        cpu->busy_ticks = saved.busy_ticks;
+        cpu->run_ticks = saved.run_ticks;
+        cpu->work_done = saved.work_done;
+        cpu->idle_ticks = saved.idle_ticks;
+        cpu->deep_ticks = saved.deep_ticks;
+        cpu->energy_since = saved.energy_since;
+        cpu->energy = saved.energy;
+        if (saved.quantum != TIMER_NONE)
+            timer_add(&timers, &cpu->quantum, saved.quantum);
+    }
+
+    checkpoint_expect(file, "IOQ ");
+    checkpoint_read(file, &count, sizeof(count));
+    for (n=0; n<count; n++)
+    {
+        io_request *r = malloc(sizeof(io_request));
+        saved_io_t saved;
+
+        assert(r != NULL);
+        checkpoint_read(file, &saved, sizeof(saved));
+        if (saved.process >= process_count)
+            checkpoint_fail("corrupt checkpoint");
+        r->pcb = &process_table[saved.process];
+        r->execution_time = saved.execution_time;
+        r->next = NULL;
+        if (io_queue_tail != NULL)
+            io_queue_tail->next = r;
+        else
+            io_queue_head = r;
+        io_queue_tail = r;
+    }
+    checkpoint_read(file, &expires, sizeof(expires));
+    if (expires != TIMER_NONE)
+        timer_add(&timers, &io_timer, expires);
+
+    checkpoint_expect(file, "SCHD");
+    sched_restore(file);
+    fclose(file);
+}
+
+
+/*
+ * publish_metrics() updates the live metrics (see metrics.h), if
+ * METRICS_INTERVAL_MS have passed since the last update or force is set.
+ * Called by the supervisor with the simulator_mutex held.
+ */
+static void publish_metrics(int force)
+{
+    struct timespec now;
+    uint64_t ns;
+    unsigned int n;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (uint64_t)(now.tv_sec - wall_start.tv_sec) * 1000000000ull +
+        now.tv_nsec - wall_start.tv_nsec;
+    if (!force && ns - metrics_ns < METRICS_INTERVAL_MS * 1000000ull)
+        return;
+
+    metrics_begin(metrics);
+    metrics->cpu_count = cpu_count;
+    metrics->process_count = process_count;
+    metrics->simulator_time = simulator_time;
+    metrics->wall_ns = ns;
+    if (ns > metrics_ns)
+        metrics->ticks_per_sec =
+            (simulator_time - metrics_time) * 1e9 / (ns - metrics_ns);
+    metrics->created = next_arrival;
+    metrics->running = running_now;
+    metrics->ready = ready_now();
+    metrics->waiting = waiting_now;
+    metrics->terminated = processes_terminated;
+    metrics->context_switches = context_switches;
+    metrics->levels = sched_queue_depths(metrics->level_depth,
+                                         METRICS_MAX_LEVELS);
+    for (n=0; n<cpu_count; n++)
+        metrics->cpu_busy[n] = simulator_cpu_data[n].busy_ticks;
+    metrics_end(metrics);
+
+    metrics_ns = ns;
+    metrics_time = simulator_time;
+}
 
 
 /* Cheap hack -- passing an int through a void pointer */
@@ -64,6 +64,21 @@ typedef struct {
  *
  *   next : An unused pointer to another PCB.  You may use this pointer to
  *        build a linked-list of PCBs.
+ *
+ *   last_cpu : The CPU the process last ran on, or -1 if it hasn't run yet.
+ *        Maintained by the simulator.  (read-only)
+ *
+ *   period : Optional minimum time, in ticks, between the starts of the
+ *        process's CPU bursts (each burst is a real-time job), 0 if none.
+ *        (read-only)
+ *
+ *   deadline : Optional time, in ticks, within which each CPU burst must
+ *        finish after it is released; 0 means the period is the deadline.
+ *        A process with neither has no timing constraint.  (read-only)
+ *
+ *   group : The threads of a multi-threaded process (a gang) are separate
+ *        PCBs, each with its own ops, that share a group number > 0.  0 for
+ *        an ordinary single-threaded process.  (read-only)
  */
 typedef struct _pcb_t {
     const unsigned int pid;
@@ -73,14 +88,145 @@ typedef struct _pcb_t {
     process_state_t state;
     op_t *pc;
     struct _pcb_t *next;
+    int last_cpu;
+    unsigned int period;
+    unsigned int deadline;
+    unsigned int group;
 } pcb_t;
 
 
 /*
- * start_simulator() runs the OS simulation.  The number of CPUs (1-16) should
- * be passed as the parameter.
+ * Machine topology.  CPUs are numbered consecutively through the hierarchy:
+ * cpus_per_llc CPUs share a last-level cache, llcs_per_node LLC domains make
+ * up a NUMA node, and nodes_per_socket nodes make up a socket.  A value of 0
+ * means "all of them" (the default: one socket, one node, one shared LLC).
+ *
+ * domain_level_t says how far apart two CPUs are.  migration_cost[level] is
+ * the number of ticks a process loses when it resumes on a CPU that far
+ * from where it last ran (migration_cost[DOMAIN_CPU] is unused).
  */
-extern void start_simulator(unsigned int cpu_count);
+typedef enum {
+    DOMAIN_CPU = 0,     /* same CPU */
+    DOMAIN_LLC,         /* different CPU, shared last-level cache */
+    DOMAIN_NODE,        /* different LLC, same NUMA node */
+    DOMAIN_SOCKET,      /* different NUMA node, same socket */
+    DOMAIN_REMOTE,      /* different socket */
+    DOMAIN_LEVELS
+} domain_level_t;
+
+typedef struct {
+    unsigned int cpus_per_llc;
+    unsigned int llcs_per_node;
+    unsigned int nodes_per_socket;
+    unsigned int migration_cost[DOMAIN_LEVELS];
+} sim_topology_t;
+
+
+/*
+ * Power model.  A busy CPU at speed 100 draws active_watts; at other speeds
+ * the part above idle_watts scales with the cube of the speed (dynamic power
+ * goes with frequency times voltage squared), so each --cpu-speeds value acts
+ * as a P-state.  An idle CPU draws idle_watts, and after deep_after idle
+ * ticks drops into deep idle at deep_watts; waking from deep idle costs
+ * wake_latency ticks before the next process runs (at active power).
+ * deep_after 0 disables deep idle.  active_watts 0 disables the model.
+ */
+typedef struct {
+    double active_watts;
+    double idle_watts;
+    double deep_watts;
+    unsigned int deep_after;
+    unsigned int wake_latency;
+} sim_power_t;
+
+#define SIM_POWER_DEFAULT { .active_watts = 10.0, .idle_watts = 3.0, \
+                            .deep_watts = 0.5, .deep_after = 10, \
+                            .wake_latency = 2 }
+
+
+/*
+ * Simulator options, passed to start_simulator().
+ *
+ *   quiet : if non-zero, don't print the Gantt chart (only final stats).
+ *
+ *   tick_usec : real time in microseconds slept between simulated ticks.
+ *        0 runs the simulation as fast as possible (for benchmarking),
+ *        and skips straight over stretches where no process is running or
+ *        ready until the next I/O completion or arrival.
+ *
+ *   switch_cost : ticks a CPU spends switching to a different process
+ *        before the process's CPU burst makes progress.
+ *
+ *   topology : the machine's cache/NUMA layout, and the extra ticks charged
+ *        when a process resumes on a different CPU than it last ran on
+ *        (its cache state has to be rebuilt).
+ *
+ *   cpu_speed : relative speed of each CPU in percent, or NULL if all CPUs
+ *        run at 100.  A CPU at 200 retires two ticks of a CPU burst per
+ *        tick, one at 50 retires a tick of work every other tick.
+ *
+ *   power : the power model used to account energy, see sim_power_t.
+ *
+ *   checkpoint_path, checkpoint_at : if checkpoint_path isn't NULL, the
+ *        state of the run is saved to it at the start of tick
+ *        checkpoint_at (see checkpoint.h), and the run stops there.
+ *
+ *   restore_path : if not NULL, the run continues from the checkpoint
+ *        saved in it instead of starting at tick 0.
+ *
+ *   branch : instead of being written to checkpoint_path, the checkpoint
+ *        taken at checkpoint_at starts the branches of the run (see
+ *        branch.h), and the run ends with their results.
+ *
+ *   metrics_name : if not NULL, live metrics are published in the shared
+ *        memory object of that name, see metrics.h.
+ */
+typedef struct {
+    int quiet;
+    unsigned long tick_usec;
+    unsigned int switch_cost;
+    sim_topology_t topology;
+    const unsigned int *cpu_speed;
+    sim_power_t power;
+    const char *checkpoint_path;
+    unsigned int checkpoint_at;
+    const char *restore_path;
+    int branch;
+    const char *metrics_name;
+} sim_config_t;
+
+#define SIM_CONFIG_DEFAULT { .quiet = 0, .tick_usec = 10, .switch_cost = 0, \
+                             .topology = { 0, 0, 0, { 0 } }, \
+                             .cpu_speed = NULL, .power = { 0 }, \
+                             .checkpoint_path = NULL, .restore_path = NULL, \
+                             .branch = 0, .metrics_name = NULL }
+
+/*
+ * parse_topology() reads a topology spec into topology, e.g.
+ * "llc=4,node=2,socket=2,cost=1:4:8:16" - CPUs per LLC, LLCs per node,
+ * nodes per socket, and the migration cost for each level from DOMAIN_LLC
+ * to DOMAIN_REMOTE.  Settings not given are left alone.  Returns 0 on
+ * success, -1 if the spec is invalid.
+ */
+extern int parse_topology(const char *spec, sim_topology_t *topology);
+
+/*
+ * parse_power() reads a power model spec into power, e.g.
+ * "active=12,idle=2,deep=0.3,deep-after=20,wake=3" (watts, and ticks for
+ * deep-after and wake).  Settings not given are left alone.  Returns 0 on
+ * success, -1 if the spec is invalid.
+ */
+extern int parse_power(const char *spec, sim_power_t *power);
+
+
+/*
+ * start_simulator() runs the OS simulation.  The number of CPUs (1 to
+ * SIM_MAX_CPUS) should be passed as the first parameter, config may be NULL
+ * to use the defaults.
+ */
+#define SIM_MAX_CPUS 256
+
+extern void start_simulator(unsigned int cpu_count, const sim_config_t *config);
 
 
 /*
@@ -93,19 +239,52 @@ extern void start_simulator(unsigned int cpu_count);
  *   time_slice : an integer containing the time slice to allocate to the
  *                process (in ticks--1/10th sec.).  Use -1 to give a process an
  *                infinite time slice (for FCFS and Priority scheduling).
+ *
+ * It returns the simulated time of the switch.  An idle CPU switches while
+ * time goes on, so get_simulator_time() may already be out of date there.
  */
-extern void context_switch(unsigned int cpu_id, pcb_t *pcb,
-                           int preemption_time);
+extern unsigned int context_switch(unsigned int cpu_id, pcb_t *pcb,
+                                   int preemption_time);
 
 
 /*
  * force_preempt() preempts a running process before its timeslice expires.
  * It should be used by the Static Priority scheduler to preempt lower
  * priority processes so that higher priority processes may execute.
+ *
+ * It doesn't block: the request is delivered at the end of the current
+ * tick, when preempt() is called on that CPU (unless its process yields or
+ * terminates first).  Until then current[] still shows the old process.
  */
 extern void force_preempt(unsigned int cpu_id);
 
 
+/*
+ * cpu_distance() returns how far apart two CPUs are in the topology given
+ * to start_simulator(), e.g. for affinity-aware scheduling.
+ */
+extern domain_level_t cpu_distance(unsigned int cpu_a, unsigned int cpu_b);
+
+
+/* cpu_speed() returns the relative speed of a CPU in percent */
+extern unsigned int cpu_speed(unsigned int cpu_id);
+
+
+/*
+ * cpu_run_ticks() returns how many ticks the process on a CPU has run since
+ * it was switched to, not counting the switch overhead.  It may be called
+ * by the preempt(), yield() and terminate() handlers for their own CPU.
+ */
+extern unsigned int cpu_run_ticks(unsigned int cpu_id);
+
+
+/*
+ * get_simulator_time() returns the current simulated time in ticks.  It may
+ * be called from the scheduler's handlers, when time is not advancing.
+ */
+extern unsigned int get_simulator_time(void);
+
+
 /*
  * mt_safe_usleep() is a thread-safe implementation of the usleep() function.
  * See man usleep(3) for the behavior of this function.
@@ -0,0 +1,120 @@
+/*
+ * simtop.c
+ * Multithreaded OS Simulation
+ *
+ * Watches a simulation started with "--metrics <name>": every interval it
+ * reads the metrics the simulator publishes in shared memory (metrics.h),
+ * without taking any lock or slowing the simulator down, and shows its
+ * progress, throughput, process states, ready queues and how busy each CPU
+ * has been since the last screen.  It exits when the run ends.
+ *
+ * Usage: ./simtop [-i <ms>] [-o] <name>
+ *   -i  time between screens in milliseconds (default 1000)
+ *   -o  print one screen, without clearing the terminal, and exit
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define CPUS_PER_LINE 8
+
+/* print_screen() shows now; busy figures are since before, if given */
+static void print_screen(const sim_metrics_t *now, const sim_metrics_t *before)
+{
+    uint64_t ticks = now->simulator_time;
+    unsigned int n;
+    int level;
+
+    if (before != NULL && now->simulator_time > before->simulator_time)
+        ticks = now->simulator_time - before->simulator_time;
+
+    printf("simOS %d: tick %llu (%.1f s simulated, %.1f s real)%s\n",
+           now->pid, (unsigned long long)now->simulator_time,
+           now->simulator_time / 10.0, now->wall_ns / 1e9,
+           now->finished ? ", finished" : "");
+    printf("Throughput: %.0f ticks/s, %llu context switches",
+           now->ticks_per_sec, (unsigned long long)now->context_switches);
+    if (before != NULL && now->wall_ns > before->wall_ns)
+        printf(" (%.0f/s)", (now->context_switches - before->context_switches)
+               * 1e9 / (now->wall_ns - before->wall_ns));
+    printf("\n");
+    printf("Processes: %u of %u created, %u running, %u ready, "
+           "%u in the I/O queue, %u terminated\n", now->created,
+           now->process_count, now->running, now->ready, now->waiting,
+           now->terminated);
+
+    printf("Ready queues (highest first):");
+    for (level = now->levels - 1; level >= 0; level--)
+        printf(" %u", now->level_depth[level]);
+    printf("\n");
+
+    printf("CPU busy %s:\n", before != NULL ? "since the last screen" :
+           "since the start");
+    for (n=0; n<now->cpu_count; n++)
+    {
+        uint64_t busy = now->cpu_busy[n];
+
+        if (before != NULL && now->simulator_time > before->simulator_time)
+            busy -= before->cpu_busy[n];
+        printf(" %3u:%4.0f%%", n, ticks > 0 ? 100.0 * busy / ticks : 0.0);
+        if (n % CPUS_PER_LINE == CPUS_PER_LINE - 1 || n == now->cpu_count - 1)
+            printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const sim_metrics_t *metrics;
+    sim_metrics_t now, before;
+    unsigned long interval = 1000;
+    int once = 0, screens = 0, opt;
+
+    while ((opt = getopt(argc, argv, "i:o")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            once = 1;
+            break;
+        default:
+            interval = 0;
+        }
+    }
+    if (interval == 0 || optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-i <ms>] [-o] <name>\n", argv[0]);
+        return -1;
+    }
+
+    metrics = metrics_attach(argv[optind]);
+    if (metrics == NULL)
+        return -1;
+
+    while (1)
+    {
+        metrics_snapshot(metrics, &now);
+        if (!once)
+            printf("\033[H\033[2J");
+        print_screen(&now, screens > 0 ? &before : NULL);
+        fflush(stdout);
+        if (once || now.finished)
+            return 0;
+        if (kill(now.pid, 0) != 0 && errno == ESRCH)
+        {
+            printf("The simulator has exited\n");
+            return -1;
+        }
+        before = now;
+        screens++;
+        usleep(interval * 1000);
+    }
+}
@@ -0,0 +1,233 @@
+/*
+ * timer.c
+ * Multithreaded OS Simulation
+ *
+ * Hierarchical timing wheel - see timer.h.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+
+#include "timer.h"
+
+/* how far ahead a level reaches: ticks due before now + LEVEL_SPAN(level) */
+#define LEVEL_SPAN(level) ((unsigned long long)1 << (TIMER_BITS * ((level)+1)))
+#define SLOT(tick, level) (((tick) >> (TIMER_BITS * (level))) & (TIMER_SLOTS-1))
+
+/* a wheel is skipped through in one step when nothing is due for this long */
+#define JUMP_TICKS TIMER_SLOTS
+
+static void place(timer_wheel_t *wheel, sim_timer_t *timer);
+static void unlink_timer(sim_timer_t *timer);
+static void cascade(timer_wheel_t *wheel, int level);
+static void jump(timer_wheel_t *wheel, unsigned int to);
+
+extern void timer_wheel_init(timer_wheel_t *wheel, unsigned int now)
+{
+    int level, slot;
+
+    wheel->now = now;
+    wheel->pending = 0;
+    for (level=0; level<TIMER_LEVELS; level++)
+        for (slot=0; slot<TIMER_SLOTS; slot++)
+            wheel->slots[level][slot] = NULL;
+}
+
+extern void timer_init(sim_timer_t *timer, timer_fn expire, unsigned int arg)
+{
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires = 0;
+    timer->expire = expire;
+    timer->arg = arg;
+}
+
+extern void timer_add(timer_wheel_t *wheel, sim_timer_t *timer,
+                      unsigned int expires)
+{
+    timer_cancel(wheel, timer);
+    timer->expires = expires;
+    if (expires < wheel->now)
+    {
+        timer->expire(timer);
+        return;
+    }
+    place(wheel, timer);
+    wheel->pending++;
+}
+
+extern void timer_cancel(timer_wheel_t *wheel, sim_timer_t *timer)
+{
+    if (!timer_pending(timer))
+        return;
+    unlink_timer(timer);
+    wheel->pending--;
+}
+
+extern void timer_run(timer_wheel_t *wheel, unsigned int until)
+{
+    sim_timer_t *batch, *timer;
+    int level;
+
+    while (wheel->now <= until)
+    {
+        if (wheel->pending == 0)
+        {
+            wheel->now = until + 1;
+            return;
+        }
+
+        /* nothing due for a while: go straight to the next timer */
+        if (until - wheel->now >= JUMP_TICKS)
+        {
+            unsigned int next = timer_next(wheel);
+
+            if (next > until)
+            {
+                jump(wheel, until + 1);
+                return;
+            }
+            if (next - wheel->now >= JUMP_TICKS)
+                jump(wheel, next);
+        }
+
+        /*
+         * Take this tick's slot as one batch, then run it.  Timers the
+         * batch adds for this same tick make another batch.
+         */
+        while ((batch = wheel->slots[0][SLOT(wheel->now, 0)]) != NULL)
+        {
+            wheel->slots[0][SLOT(wheel->now, 0)] = NULL;
+            batch->prev = &batch;
+            while (batch != NULL)
+            {
+                timer = batch;
+                assert(timer->expires == wheel->now);
+                unlink_timer(timer);
+                wheel->pending--;
+                timer->expire(timer);
+            }
+        }
+
+        /* move on, pulling down the coarser slots the new tick reaches */
+        wheel->now++;
+        for (level=1; level<TIMER_LEVELS &&
+             SLOT(wheel->now, level-1) == 0; level++)
+            cascade(wheel, level);
+    }
+}
+
+extern unsigned int timer_next(const timer_wheel_t *wheel)
+{
+    unsigned int next = TIMER_NONE;
+    sim_timer_t *timer;
+    int level, i;
+
+    if (wheel->pending == 0)
+        return TIMER_NONE;
+
+    /*
+     * Level 0 holds exact ticks in order from now.  In a coarser level the
+     * first non-empty slot after the current one covers the earliest
+     * range, but its timers have to be looked at.  A timer that has been
+     * waiting in a coarser level may be due before the level 0 ones.
+     */
+    for (i=0; i<TIMER_SLOTS; i++)
+    {
+        if (wheel->slots[0][SLOT(wheel->now + i, 0)] != NULL)
+        {
+            next = wheel->now + i;
+            break;
+        }
+    }
+    for (level=1; level<TIMER_LEVELS; level++)
+    {
+        unsigned int current = SLOT(wheel->now, level);
+
+        for (i=1; i<=TIMER_SLOTS; i++)
+        {
+            timer = wheel->slots[level][(current + i) % TIMER_SLOTS];
+            if (timer == NULL)
+                continue;
+            for (; timer != NULL; timer = timer->next)
+                if (timer->expires < next)
+                    next = timer->expires;
+            break;
+        }
+    }
+    return next;
+}
+
+/* put a timer in the slot for its expiry, relative to the wheel's now */
+static void place(timer_wheel_t *wheel, sim_timer_t *timer)
+{
+    unsigned long long delta = timer->expires - wheel->now;
+    sim_timer_t **slot;
+    int level = 0;
+
+    while (level < TIMER_LEVELS - 1 && delta >= LEVEL_SPAN(level))
+        level++;
+    slot = &wheel->slots[level][SLOT(timer->expires, level)];
+
+    timer->next = *slot;
+    timer->prev = slot;
+    if (*slot != NULL)
+        (*slot)->prev = &timer->next;
+    *slot = timer;
+}
+
+static void unlink_timer(sim_timer_t *timer)
+{
+    *timer->prev = timer->next;
+    if (timer->next != NULL)
+        timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+/* re-place the timers of the level's current slot, which are now closer */
+static void cascade(timer_wheel_t *wheel, int level)
+{
+    sim_timer_t **slot = &wheel->slots[level][SLOT(wheel->now, level)];
+    sim_timer_t *timer = *slot, *next;
+
+    *slot = NULL;
+    for (; timer != NULL; timer = next)
+    {
+        next = timer->next;
+        place(wheel, timer);
+    }
+}
+
+/*
+ * Move now forward to tick to, which no pending timer is due before, by
+ * taking every timer out and placing it again.
+ */
+static void jump(timer_wheel_t *wheel, unsigned int to)
+{
+    sim_timer_t *all = NULL, *timer, *next;
+    int level, slot;
+
+    for (level=0; level<TIMER_LEVELS; level++)
+    {
+        for (slot=0; slot<TIMER_SLOTS; slot++)
+        {
+            for (timer = wheel->slots[level][slot]; timer != NULL;
+                 timer = next)
+            {
+                next = timer->next;
+                timer->next = all;
+                all = timer;
+            }
+            wheel->slots[level][slot] = NULL;
+        }
+    }
+
+    wheel->now = to;
+    for (timer = all; timer != NULL; timer = next)
+    {
+        next = timer->next;
+        assert(timer->expires >= to);
+        place(wheel, timer);
+    }
+}
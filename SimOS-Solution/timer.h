@@ -0,0 +1,82 @@
+/*
+ * timer.h
+ * Multithreaded OS Simulation
+ *
+ * Hierarchical timing wheel for the simulator's timed events: quantum
+ * expiries, I/O completions and process arrivals.
+ *
+ * TIMER_LEVELS wheels of TIMER_SLOTS slots each.  A timer due within
+ * TIMER_SLOTS ticks sits in the level 0 slot for its tick; one due later
+ * sits in a coarser level, in the slot covering TIMER_SLOTS^level ticks
+ * that contains it, and is moved down a level (cascaded) when the wheel
+ * below wraps around to that slot.  Adding and cancelling a timer is O(1),
+ * and running a tick only touches the slots that are due.
+ *
+ * The wheel does no locking; the simulator only uses it with the
+ * simulator_mutex held.
+ */
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 6          /* 36 bits, more than an unsigned int tick */
+
+/* timer_next()'s answer when no timer is pending */
+#define TIMER_NONE ((unsigned int)-1)
+
+struct _sim_timer_t;
+typedef void (*timer_fn)(struct _sim_timer_t *timer);
+
+/*
+ * One timer, usually embedded in whatever it times.  expire is called
+ * with the timer when it goes off, and arg is left for it to use.  The
+ * list links are owned by the wheel; prev is NULL while the timer isn't
+ * pending.
+ */
+typedef struct _sim_timer_t {
+    struct _sim_timer_t *next;
+    struct _sim_timer_t **prev;
+    unsigned int expires;
+    timer_fn expire;
+    unsigned int arg;
+} sim_timer_t;
+
+typedef struct {
+    unsigned int now;           /* the next tick timer_run() will expire */
+    unsigned int pending;
+    sim_timer_t *slots[TIMER_LEVELS][TIMER_SLOTS];
+} timer_wheel_t;
+
+/* timer_wheel_init() empties a wheel, whose first tick will be now */
+extern void timer_wheel_init(timer_wheel_t *wheel, unsigned int now);
+
+/* timer_init() sets up a timer before it is first added */
+extern void timer_init(sim_timer_t *timer, timer_fn expire, unsigned int arg);
+
+/*
+ * timer_add() makes a timer go off at tick expires, moving it if it was
+ * already pending.  A timer due on a tick that timer_run() has already
+ * done goes off at once, from timer_add().
+ */
+extern void timer_add(timer_wheel_t *wheel, sim_timer_t *timer,
+                      unsigned int expires);
+
+/* timer_cancel() stops a pending timer; it does nothing otherwise */
+extern void timer_cancel(timer_wheel_t *wheel, sim_timer_t *timer);
+
+#define timer_pending(timer) ((timer)->prev != NULL)
+
+/*
+ * timer_run() expires the timers due up to and including tick until, a
+ * tick at a time, as one batch per tick.  Stretches without any timers
+ * are skipped in one step, so it can be used to fast-forward as well as
+ * once per tick.
+ */
+extern void timer_run(timer_wheel_t *wheel, unsigned int until);
+
+/* timer_next() returns the tick the earliest pending timer is due */
+extern unsigned int timer_next(const timer_wheel_t *wheel);
+
+#endif /* __TIMER_H__ */
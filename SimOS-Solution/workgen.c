@@ -0,0 +1,525 @@
+/*
+ * workgen.c
+ * Multithreaded OS Simulation
+ *
+ * Synthetic workload generator - see workgen.h for the spec format.
+ *
+ * Every process has its own random stream, seeded from the workload seed
+ * and its pid, so the ops a process sees don't depend on the order the
+ * simulator happens to advance processes in.  The only per-process state
+ * is the stream, the number of CPU bursts left, and the current op.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simOS.h"
+#include "workload.h"
+#include "workgen.h"
+
+typedef enum { DIST_FIXED = 0, DIST_UNIFORM, DIST_EXP, DIST_BIMODAL,
+               DIST_PARETO } dist_type;
+
+typedef struct {
+    dist_type type;
+    double a, b, c;
+} dist_t;
+
+/*
+ * How process arrival times are generated: independent gaps drawn from a
+ * distribution (fixed:10, or exp for Poisson arrivals), groups of
+ * burst_size processes arriving together every period ticks, or Poisson
+ * arrivals whose rate follows a sine wave with the given period and depth.
+ */
+typedef enum { ARRIVE_GAPS = 0, ARRIVE_BURST, ARRIVE_DIURNAL } arrival_mode;
+
+typedef struct {
+    arrival_mode mode;
+    dist_t gap;
+    double rate;
+    double burst_size;
+    double period;
+    double depth;
+} arrival_t;
+
+/* burst and priority distributions of one class of process */
+typedef struct {
+    dist_t cpu;
+    dist_t io;
+    dist_t priority;
+} class_params_t;
+
+typedef struct {
+    unsigned int count;
+    uint64_t seed;
+    double mix;
+    dist_t bursts;
+    arrival_t arrival;
+    class_params_t io_bound;
+    class_params_t cpu_bound;
+    double rt;
+    dist_t period;
+    dist_t deadline;
+    int deadline_given;
+    dist_t threads;
+} workgen_spec_t;
+
+/* per-process generator state */
+typedef struct {
+    uint64_t rng;
+    unsigned int bursts_left;
+    unsigned int io_bound;
+    op_t op;
+} gen_proc_t;
+
+static workgen_spec_t spec;
+static gen_proc_t *gen;
+
+
+/*
+ * Random numbers: splitmix64 to derive a per-process seed, xorshift64* for
+ * the stream itself.
+ */
+static uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/* uniform double in [0, 1) */
+static double next_uniform(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return ((x * 0x2545f4914f6cdd1dull) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double sample(const dist_t *d, uint64_t *rng)
+{
+    double u = next_uniform(rng);
+
+    switch (d->type)
+    {
+    case DIST_FIXED:
+        return d->a;
+    case DIST_UNIFORM:
+        return floor(d->a + u * (d->b - d->a + 1));
+    case DIST_EXP:
+        return -d->a * log(1.0 - u);
+    case DIST_BIMODAL:
+        return -(u < d->c ? d->a : d->b) * log(1.0 - next_uniform(rng));
+    case DIST_PARETO:
+        return d->b / pow(1.0 - u, 1.0 / d->a);
+    }
+    return 0;
+}
+
+/* a burst length in whole ticks, at least 1 */
+static int sample_burst(const dist_t *d, uint64_t *rng)
+{
+    double x = sample(d, rng) + 0.5;
+    if (x < 1)
+        return 1;
+    if (x > 1e9)
+        return 1000000000;
+    return (int)x;
+}
+
+
+/*
+ * next_generated_op() is the workload's next_op: CPU bursts alternate with
+ * I/O bursts until the process's last CPU burst, which is followed by
+ * OP_TERMINATE.  The new op overwrites the old one in place.
+ */
+static op_t *next_generated_op(pcb_t *pcb)
+{
+    gen_proc_t *g = &gen[process_index(pcb)];
+    class_params_t *class = g->io_bound ? &spec.io_bound : &spec.cpu_bound;
+
+    if (g->op.type == OP_CPU)
+    {
+        if (g->bursts_left == 0)
+        {
+            g->op.type = OP_TERMINATE;
+            g->op.time = 0;
+        }
+        else
+        {
+            g->op.type = OP_IO;
+            g->op.time = sample_burst(&class->io, &g->rng);
+        }
+    }
+    else if (g->op.type == OP_IO)
+    {
+        g->bursts_left--;
+        g->op.type = OP_CPU;
+        g->op.time = sample_burst(&class->cpu, &g->rng);
+    }
+    return pcb->pc;
+}
+
+
+/*
+ * Spec parsing
+ */
+static int parse_dist(const char *text, dist_t *d)
+{
+    char name[16];
+    int n = 0;
+
+    d->a = d->b = d->c = 0;
+    if (sscanf(text, "%15[a-z]:%n", name, &n) != 1 || n == 0)
+        return -1;
+    text += n;
+
+    if (strcmp(name, "fixed") == 0)
+    {
+        d->type = DIST_FIXED;
+        return sscanf(text, "%lf", &d->a) == 1 ? 0 : -1;
+    }
+    if (strcmp(name, "uniform") == 0)
+    {
+        d->type = DIST_UNIFORM;
+        return sscanf(text, "%lf:%lf", &d->a, &d->b) == 2 && d->a <= d->b
+            ? 0 : -1;
+    }
+    if (strcmp(name, "exp") == 0)
+    {
+        d->type = DIST_EXP;
+        return sscanf(text, "%lf", &d->a) == 1 && d->a > 0 ? 0 : -1;
+    }
+    if (strcmp(name, "bimodal") == 0)
+    {
+        d->type = DIST_BIMODAL;
+        return sscanf(text, "%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3 &&
+            d->a > 0 && d->b > 0 && d->c >= 0 && d->c <= 1 ? 0 : -1;
+    }
+    if (strcmp(name, "pareto") == 0)
+    {
+        d->type = DIST_PARETO;
+        return sscanf(text, "%lf:%lf", &d->a, &d->b) == 2 &&
+            d->a > 0 && d->b > 0 ? 0 : -1;
+    }
+    return -1;
+}
+
+static int parse_arrival(const char *text, arrival_t *a)
+{
+    a->rate = a->burst_size = a->period = a->depth = 0;
+
+    if (sscanf(text, "poisson:%lf", &a->rate) == 1)
+    {
+        if (a->rate <= 0)
+            return -1;
+        a->mode = ARRIVE_GAPS;
+        a->gap.type = DIST_EXP;
+        a->gap.a = 1.0 / a->rate;
+        return 0;
+    }
+    if (strncmp(text, "burst:", 6) == 0)
+    {
+        a->mode = ARRIVE_BURST;
+        return sscanf(text, "burst:%lf:%lf", &a->burst_size, &a->period) == 2
+            && a->burst_size >= 1 && a->period >= 0 ? 0 : -1;
+    }
+    if (strncmp(text, "diurnal:", 8) == 0)
+    {
+        a->mode = ARRIVE_DIURNAL;
+        a->depth = 0.9;
+        return sscanf(text, "diurnal:%lf:%lf:%lf", &a->rate, &a->period,
+                      &a->depth) >= 2 && a->rate > 0 && a->period > 0 &&
+            a->depth >= 0 && a->depth <= 1 ? 0 : -1;
+    }
+
+    a->mode = ARRIVE_GAPS;
+    return parse_dist(text, &a->gap);
+}
+
+/*
+ * generate_arrivals() fills in count arrival times, in ticks, in
+ * non-decreasing order.
+ */
+static void generate_arrivals(const arrival_t *a, unsigned int count,
+                              uint64_t seed, unsigned int *arrivals)
+{
+    uint64_t rng = splitmix64(~seed) | 1;
+    double clock = 0, gap, peak;
+    unsigned int i;
+
+    for (i=0; i<count; i++)
+    {
+        switch (a->mode)
+        {
+        case ARRIVE_GAPS:
+            if (i > 0)
+            {
+                gap = sample(&a->gap, &rng);
+                clock += gap > 0 ? gap : 0;
+            }
+            break;
+
+        case ARRIVE_BURST:
+            clock = floor(i / (unsigned int)a->burst_size) * a->period;
+            break;
+
+        case ARRIVE_DIURNAL:
+            /* thinning: candidates at the peak rate, kept in proportion
+               to the rate at that time of "day" */
+            peak = a->rate * (1 + a->depth);
+            do {
+                clock += -log(1.0 - next_uniform(&rng)) / peak;
+            } while (next_uniform(&rng) * peak >
+                     a->rate * (1 + a->depth *
+                                sin(2 * M_PI * clock / a->period)));
+            break;
+        }
+        arrivals[i] = clock < 4e9 ? (unsigned int)clock : 4000000000u;
+    }
+}
+
+static int parse_spec(const char *text, workgen_spec_t *s)
+{
+    char *copy, *item, *save;
+    int result = 0;
+
+    s->count = 1000;
+    s->seed = 1;
+    s->mix = 0.5;
+    parse_dist("exp:20", &s->bursts);
+    parse_arrival("fixed:10", &s->arrival);
+    parse_dist("exp:2", &s->io_bound.cpu);
+    parse_dist("exp:4", &s->io_bound.io);
+    parse_dist("uniform:6:9", &s->io_bound.priority);
+    parse_dist("exp:10", &s->cpu_bound.cpu);
+    parse_dist("exp:1.5", &s->cpu_bound.io);
+    parse_dist("uniform:1:5", &s->cpu_bound.priority);
+    s->rt = 0;
+    parse_dist("uniform:20:100", &s->period);
+    s->deadline_given = 0;
+    parse_dist("fixed:1", &s->threads);
+
+    copy = strdup(text);
+    for (item = strtok_r(copy, ",", &save); item != NULL && result == 0;
+         item = strtok_r(NULL, ",", &save))
+    {
+        char *value = strchr(item, '=');
+
+        if (value == NULL)
+        {
+            result = -1;
+            break;
+        }
+        *value++ = '\0';
+
+        if (strcmp(item, "n") == 0)
+        {
+            long n = strtol(value, NULL, 10);
+            s->count = n > 0 ? (unsigned int)n : 0;
+            result = s->count > 0 ? 0 : -1;
+        }
+        else if (strcmp(item, "seed") == 0)
+            s->seed = strtoull(value, NULL, 10);
+        else if (strcmp(item, "mix") == 0)
+        {
+            s->mix = strtod(value, NULL);
+            result = s->mix >= 0 && s->mix <= 1 ? 0 : -1;
+        }
+        else if (strcmp(item, "bursts") == 0)
+            result = parse_dist(value, &s->bursts);
+        else if (strcmp(item, "arrival") == 0)
+            result = parse_arrival(value, &s->arrival);
+        else if (strcmp(item, "icpu") == 0)
+            result = parse_dist(value, &s->io_bound.cpu);
+        else if (strcmp(item, "iio") == 0)
+            result = parse_dist(value, &s->io_bound.io);
+        else if (strcmp(item, "iprio") == 0)
+            result = parse_dist(value, &s->io_bound.priority);
+        else if (strcmp(item, "ccpu") == 0)
+            result = parse_dist(value, &s->cpu_bound.cpu);
+        else if (strcmp(item, "cio") == 0)
+            result = parse_dist(value, &s->cpu_bound.io);
+        else if (strcmp(item, "cprio") == 0)
+            result = parse_dist(value, &s->cpu_bound.priority);
+        else if (strcmp(item, "rt") == 0)
+        {
+            s->rt = strtod(value, NULL);
+            result = s->rt >= 0 && s->rt <= 1 ? 0 : -1;
+        }
+        else if (strcmp(item, "period") == 0)
+            result = parse_dist(value, &s->period);
+        else if (strcmp(item, "deadline") == 0)
+        {
+            result = parse_dist(value, &s->deadline);
+            s->deadline_given = 1;
+        }
+        else if (strcmp(item, "threads") == 0)
+            result = parse_dist(value, &s->threads);
+        else
+            result = -1;
+
+        if (result != 0)
+            fprintf(stderr, "bad workload setting \"%s=%s\"\n", item, value);
+    }
+    free(copy);
+    return result;
+}
+
+
+extern int workgen_generate(const char *text)
+{
+    pcb_t *table;
+    unsigned int *arrivals;
+    char *names, *name;
+    unsigned int i, name_len;
+    unsigned int group = 0, threads_left = 0, leader = 0;
+    uint64_t thread_rng;
+
+    if (parse_spec(text, &spec) != 0)
+    {
+        fprintf(stderr, "invalid workload spec \"%s\" - see workgen.h\n", text);
+        return -1;
+    }
+
+    /* thread counts come from a stream of their own */
+    thread_rng = splitmix64(spec.seed ^ 0x7468726561647321ull) | 1;
+
+    /* names are "I<pid>" / "C<pid>", packed into one buffer */
+    name_len = snprintf(NULL, 0, "I%u", spec.count - 1) + 1;
+
+    table = malloc(sizeof(pcb_t) * spec.count);
+    gen = malloc(sizeof(gen_proc_t) * spec.count);
+    arrivals = malloc(sizeof(unsigned int) * spec.count);
+    names = malloc((size_t)name_len * spec.count);
+    if (table == NULL || gen == NULL || arrivals == NULL || names == NULL)
+    {
+        fprintf(stderr, "not enough memory for %u processes\n", spec.count);
+        return -1;
+    }
+
+    for (i=0; i<spec.count; i++)
+    {
+        gen_proc_t *g = &gen[i];
+        class_params_t *class;
+        double priority;
+
+        g->rng = splitmix64(spec.seed ^ splitmix64(i));
+        if (g->rng == 0)
+            g->rng = 1;
+        g->io_bound = next_uniform(&g->rng) < spec.mix;
+        class = g->io_bound ? &spec.io_bound : &spec.cpu_bound;
+        g->bursts_left = sample_burst(&spec.bursts, &g->rng) - 1;
+        g->op.type = OP_CPU;
+        g->op.time = sample_burst(&class->cpu, &g->rng);
+
+        priority = floor(sample(&class->priority, &g->rng) + 0.5);
+        if (priority < 0)
+            priority = 0;
+        if (priority > 10)
+            priority = 10;
+
+        /*
+         * The other threads of a process take its class, priority and
+         * number of bursts from the first one, but draw their own burst
+         * lengths.
+         */
+        if (threads_left > 0)
+        {
+            threads_left--;
+            g->io_bound = gen[leader].io_bound;
+            g->bursts_left = gen[leader].bursts_left;
+            g->op.time = sample_burst(g->io_bound ? &spec.io_bound.cpu :
+                                      &spec.cpu_bound.cpu, &g->rng);
+            priority = table[leader].static_priority;
+        }
+        else
+        {
+            threads_left = sample_burst(&spec.threads, &thread_rng) - 1;
+            leader = i;
+            if (threads_left > 0)
+                group++;
+        }
+
+        name = names + (size_t)i * name_len;
+        snprintf(name, name_len, "%c%u", g->io_bound ? 'I' : 'C', i);
+        workload_init_pcb(&table[i], i, name, (unsigned int)priority, &g->op);
+        if (threads_left > 0 || leader != i)
+            table[i].group = group;
+
+        /*
+         * Real-time constraints come from a stream of their own, so adding
+         * them doesn't change the rest of the workload.
+         */
+        if (spec.rt > 0)
+        {
+            uint64_t rng = splitmix64(spec.seed ^ splitmix64(~(uint64_t)i)) | 1;
+
+            if (next_uniform(&rng) < spec.rt)
+            {
+                table[i].period = sample_burst(&spec.period, &rng);
+                if (spec.deadline_given)
+                    table[i].deadline = sample_burst(&spec.deadline, &rng);
+            }
+        }
+    }
+    generate_arrivals(&spec.arrival, spec.count, spec.seed, arrivals);
+
+    /* the threads of a process are created together */
+    for (i=1; i<spec.count; i++)
+    {
+        if (table[i].group != 0 && table[i].group == table[i-1].group)
+            arrivals[i] = arrivals[i-1];
+    }
+
+    workload_install(table, spec.count, arrivals, next_generated_op);
+    return 0;
+}
+
+extern int workgen_arrivals(const char *text)
+{
+    arrival_t arrival;
+    unsigned int *arrivals;
+    /* the generated workload's seed, if there is one */
+    uint64_t seed = spec.count > 0 ? spec.seed : 1;
+    char *process = strdup(text), *option, *end;
+    int valid;
+
+    if (process == NULL)
+    {
+        fprintf(stderr, "not enough memory\n");
+        return -1;
+    }
+    option = strstr(process, ",seed=");
+    valid = 1;
+    if (option != NULL)
+    {
+        *option = '\0';
+        seed = strtoull(option + 6, &end, 10);
+        valid = end != option + 6 && *end == '\0';
+    }
+    valid = valid && parse_arrival(process, &arrival) == 0;
+    free(process);
+    if (!valid)
+    {
+        fprintf(stderr, "invalid arrival process \"%s\" - see workgen.h\n",
+                text);
+        return -1;
+    }
+
+    arrivals = malloc(sizeof(unsigned int) * process_count);
+    if (arrivals == NULL)
+    {
+        fprintf(stderr, "not enough memory for %u arrivals\n", process_count);
+        return -1;
+    }
+    generate_arrivals(&arrival, process_count, seed, arrivals);
+    workload_set_arrivals(arrivals);
+    return 0;
+}
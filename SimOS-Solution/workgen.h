@@ -0,0 +1,73 @@
+/*
+ * workgen.h
+ * Multithreaded OS Simulation
+ *
+ * Synthetic workload generator.
+ *
+ * A workload is described by a spec string of comma separated key=value
+ * pairs, e.g. "n=100000,seed=7,mix=0.3,ccpu=pareto:1.5:4,arrival=exp:2".
+ * Each process is either I/O-bound (named I<pid>) or CPU-bound (C<pid>),
+ * and alternates CPU and I/O bursts drawn from its class's distributions,
+ * ending with a CPU burst.
+ *
+ *   n=<count>       number of processes                        (1000)
+ *   seed=<number>   random seed, same seed gives same workload (1)
+ *   mix=<fraction>  fraction of processes that are I/O-bound   (0.5)
+ *   bursts=<dist>   CPU bursts per process                     (exp:20)
+ *   icpu=<dist>     CPU burst length of I/O-bound processes    (exp:2)
+ *   iio=<dist>      I/O burst length of I/O-bound processes    (exp:4)
+ *   ccpu=<dist>     CPU burst length of CPU-bound processes    (exp:10)
+ *   cio=<dist>      I/O burst length of CPU-bound processes    (exp:1.5)
+ *   iprio=<dist>    static priority of I/O-bound processes     (uniform:6:9)
+ *   cprio=<dist>    static priority of CPU-bound processes     (uniform:1:5)
+ *   arrival=<arr>   arrival process                            (fixed:10)
+ *   rt=<fraction>   fraction of real-time processes            (0)
+ *   period=<dist>   period of real-time processes              (uniform:20:100)
+ *   deadline=<dist> their relative deadline                    (the period)
+ *   threads=<dist>  threads per process                        (fixed:1)
+ *
+ * Distributions (<dist>):
+ *   fixed:v             always v
+ *   uniform:lo:hi       integers lo..hi, equally likely
+ *   exp:mean            exponential (exp:k arrivals = Poisson arrivals)
+ *   bimodal:a:b:p       exponential with mean a with probability p, else b
+ *   pareto:alpha:xmin   heavy-tailed Pareto
+ *
+ * Arrival processes (<arr>):
+ *   <dist>                   ticks between consecutive arrivals
+ *   poisson:rate             Poisson arrivals, rate per tick (= exp:1/rate)
+ *   burst:size:period        size processes at once, every period ticks
+ *   diurnal:rate:period[:d]  Poisson arrivals whose rate swings between
+ *                            rate*(1-d) and rate*(1+d) over each period
+ *                            ticks (d defaults to 0.9)
+ *
+ * n counts threads: a process with k threads takes k consecutive entries
+ * of the table, sharing a group number (see pcb_t), class, priority,
+ * number of bursts and arrival time; the last process may get fewer.
+ *
+ * Burst lengths, periods and deadlines are rounded to whole ticks and
+ * thread counts to whole numbers (all at least 1), priorities are clamped
+ * to 0-10.  Ops are generated on demand as
+ * each process advances, so only one op per process is ever resident.
+ */
+
+#ifndef __WORKGEN_H__
+#define __WORKGEN_H__
+
+/*
+ * workgen_generate() builds the workload described by spec and installs it
+ * as the process table.  Returns 0 on success, -1 (after printing a
+ * message) if the spec is invalid.
+ */
+extern int workgen_generate(const char *spec);
+
+/*
+ * workgen_arrivals() replaces the arrival times of the installed workload
+ * (whatever it is) with ones from the arrival process spec, in table order.
+ * The spec may end in ",seed=<number>"; otherwise the seed of the generated
+ * workload is used, or 1 if it isn't generated.  Returns 0 on success, -1
+ * if the spec is invalid.
+ */
+extern int workgen_arrivals(const char *spec);
+
+#endif /* __WORKGEN_H__ */
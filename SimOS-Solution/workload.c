@@ -0,0 +1,588 @@
+/*
+ * workload.c
+ * Multithreaded OS Simulation
+ *
+ * Process table management - see workload.h.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simOS.h"
+#include "proc.h"
+#include "workload.h"
+
+pcb_t *process_table = processes;
+unsigned int process_count = PROCESS_COUNT;
+
+static unsigned int *arrival_times = NULL;
+static next_op_fn next_op = NULL;
+
+/*
+ * Programs with repeat groups are compiled to instructions: a burst, or
+ * INSN_LOOP (arg = repeat count) ... INSN_NEXT (arg = how far back the
+ * group's first instruction is).  Each process runs its program with a
+ * cursor holding the remaining repeats of the groups it is in, and its
+ * current op, which pc points at.  So "(C2 I2)x1000000" is three
+ * instructions, and a process costs its cursor however long it runs.
+ */
+typedef enum { INSN_CPU = OP_CPU, INSN_IO = OP_IO, INSN_END = OP_TERMINATE,
+               INSN_LOOP, INSN_NEXT } insn_kind;
+
+typedef struct {
+    insn_kind kind;
+    unsigned int arg;
+} insn_t;
+
+#define MAX_NESTING 8
+
+typedef struct {
+    const insn_t *ip;
+    unsigned int depth;
+    unsigned int left[MAX_NESTING];
+    op_t op;
+} cursor_t;
+
+static cursor_t *cursors = NULL;
+
+/*
+ * A streamed workload file keeps going after its "ops:" line with op
+ * records, read only as the processes need them.  Ops read ahead for other
+ * processes wait in those processes' queues; each process also has its
+ * current op, which pc points at.  expect is the kind of burst its next
+ * record has to go on with, OP_TERMINATE once it has exited.
+ */
+typedef struct {
+    op_t op;
+    op_t *queue;
+    unsigned int head, count, cap;
+    op_type expect;
+} stream_t;
+
+static stream_t *streams = NULL;
+static FILE *stream_file = NULL;
+static const char *stream_path;
+static size_t stream_line_no;
+static char *stream_line = NULL;
+static size_t stream_line_cap = 0;
+
+extern void workload_init_pcb(pcb_t *slot, unsigned int pid, const char *name,
+                              unsigned int priority, op_t *ops)
+{
+    pcb_t pcb = { pid, name, priority, priority, PROCESS_NEW, ops, NULL, -1,
+                  0, 0, 0 };
+    memcpy(slot, &pcb, sizeof(pcb_t));
+}
+
+/* run a cursor up to its next burst (or the end), and return that op */
+static op_t *program_step(cursor_t *c)
+{
+    const insn_t *insn;
+
+    while (1)
+    {
+        insn = c->ip++;
+        switch (insn->kind)
+        {
+        case INSN_LOOP:
+            c->left[c->depth++] = insn->arg;
+            break;
+
+        case INSN_NEXT:
+            if (--c->left[c->depth-1] > 0)
+                c->ip = insn - insn->arg;
+            else
+                c->depth--;
+            break;
+
+        default:
+            c->op.type = (op_type)insn->kind;
+            c->op.time = insn->arg;
+            return &c->op;
+        }
+    }
+}
+
+static op_t *next_program_op(pcb_t *pcb)
+{
+    pcb->pc = program_step(&cursors[process_index(pcb)]);
+    return pcb->pc;
+}
+
+/* a malformed record in the middle of a run can only end it */
+static void stream_error(const char *message)
+{
+    fprintf(stderr, "%s:%zu: %s\n", stream_path, stream_line_no, message);
+    exit(-1);
+}
+
+static void stream_push(stream_t *s, op_type type, unsigned int time)
+{
+    if (s->count == s->cap)
+    {
+        unsigned int cap = s->cap > 0 ? 2 * s->cap : 4, i;
+        op_t *queue = malloc(sizeof(op_t) * cap);
+
+        assert(queue != NULL);
+        for (i=0; i<s->count; i++)
+            queue[i] = s->queue[(s->head + i) % s->cap];
+        free(s->queue);
+        s->queue = queue;
+        s->head = 0;
+        s->cap = cap;
+    }
+    s->queue[(s->head + s->count) % s->cap].type = type;
+    s->queue[(s->head + s->count) % s->cap].time = time;
+    s->count++;
+}
+
+/* read the next op record, queueing its ops for their process */
+static void read_stream(void)
+{
+    unsigned int index, time;
+    stream_t *s;
+    char kind, *p;
+    int n;
+
+    while (1)
+    {
+        if (getline(&stream_line, &stream_line_cap, stream_file) == -1)
+            stream_error("the ops end before every process has exited");
+        stream_line_no++;
+        p = stream_line + strspn(stream_line, " \t");
+        if (*p != '#' && *p != '\n' && *p != '\r' && *p != '\0')
+            break;
+    }
+
+    if (sscanf(p, "%u%n", &index, &n) != 1 || index >= process_count)
+        stream_error("expected \"<process> ops\"");
+    p += n;
+    s = &streams[index];
+
+    while (sscanf(p, " %c%n", &kind, &n) == 1)
+    {
+        p += n;
+        if (s->expect == OP_TERMINATE)
+            stream_error("ops after X");
+        if (kind == 'X')
+        {
+            if (s->expect != OP_IO)
+                stream_error("ops must start and end with a CPU burst");
+            stream_push(s, OP_TERMINATE, 0);
+            s->expect = OP_TERMINATE;
+            continue;
+        }
+        if ((kind != 'C' && kind != 'I') || sscanf(p, "%u%n", &time, &n) != 1)
+            stream_error("bad op, expected C<n>, I<n> or X");
+        if ((kind == 'C' ? OP_CPU : OP_IO) != s->expect)
+            stream_error("ops must alternate C<n> I<n> ..., starting with C");
+        stream_push(s, s->expect, time);
+        s->expect = s->expect == OP_CPU ? OP_IO : OP_CPU;
+        p += n;
+    }
+}
+
+static op_t *next_streamed_op(pcb_t *pcb)
+{
+    stream_t *s = &streams[process_index(pcb)];
+
+    while (s->count == 0)
+        read_stream();
+    s->op = s->queue[s->head];
+    s->head = (s->head + 1) % s->cap;
+    s->count--;
+
+    /* nothing more will be read for it */
+    if (s->op.type == OP_TERMINATE)
+    {
+        free(s->queue);
+        s->queue = NULL;
+        s->head = s->cap = 0;
+    }
+    pcb->pc = &s->op;
+    return pcb->pc;
+}
+
+extern void workload_install(pcb_t *table, unsigned int count,
+                             unsigned int *arrivals, next_op_fn new_next_op)
+{
+    assert(table != NULL && count > 0);
+    process_table = table;
+    process_count = count;
+    arrival_times = arrivals;
+    next_op = new_next_op;
+}
+
+extern void workload_set_arrivals(unsigned int *arrivals)
+{
+    arrival_times = arrivals;
+}
+
+/* grow a malloc'd array so it can hold at least need elements */
+static void *reserve(void *array, size_t *capacity, size_t need, size_t size)
+{
+    if (need <= *capacity)
+        return array;
+    *capacity = need > 2 * *capacity ? need : 2 * *capacity;
+    array = realloc(array, *capacity * size);
+    assert(array != NULL);
+    return array;
+}
+
+/* append an instruction to a growing program */
+static void emit(insn_t **insns, size_t *count, size_t *cap, insn_kind kind,
+                 unsigned int arg)
+{
+    *insns = reserve(*insns, cap, *count + 1, sizeof(insn_t));
+    (*insns)[*count].kind = kind;
+    (*insns)[*count].arg = arg;
+    (*count)++;
+}
+
+/*
+ * parse_program() compiles the ops of one workload file line, appending
+ * them to insns and counting the repeat groups in *loops.  The bursts
+ * must alternate as they run, so a group repeated more than once has to
+ * start with the kind of burst it ends before.  Returns 0, or -1 after
+ * printing a message.
+ */
+static int parse_program(const char *p, const char *path, size_t line_no,
+                         insn_t **insns, size_t *count, size_t *cap,
+                         unsigned int *loops)
+{
+    size_t group[MAX_NESTING];          /* where each open group starts */
+    op_type first[MAX_NESTING];         /* ... and its first burst */
+    op_type expect = OP_CPU;
+    unsigned int depth = 0, time;
+    size_t start = *count;
+    char kind;
+    int n;
+
+    while (1)
+    {
+        p += strspn(p, " \t");
+        if (*p == '(')
+        {
+            if (depth == MAX_NESTING)
+            {
+                fprintf(stderr, "%s:%zu: groups nested more than %d deep\n",
+                        path, line_no, MAX_NESTING);
+                return -1;
+            }
+            group[depth] = *count;
+            first[depth++] = OP_TERMINATE;      /* none yet */
+            emit(insns, count, cap, INSN_LOOP, 0);
+            p++;
+        }
+        else if (*p == ')')
+        {
+            if (depth == 0 || sscanf(p, ")x%u%n", &time, &n) != 1 ||
+                time == 0 || first[depth-1] == OP_TERMINATE)
+            {
+                fprintf(stderr, "%s:%zu: expected \"(ops)x<count>\"\n",
+                        path, line_no);
+                return -1;
+            }
+            depth--;
+            if (time > 1 && first[depth] != expect)
+            {
+                fprintf(stderr, "%s:%zu: a repeated group must start and end "
+                        "with different kinds of burst\n", path, line_no);
+                return -1;
+            }
+            (*insns)[group[depth]].arg = time;
+            emit(insns, count, cap, INSN_NEXT, *count - group[depth] - 1);
+            (*loops)++;
+            p += n;
+        }
+        else if (sscanf(p, "%c%u%n", &kind, &time, &n) == 2 &&
+                 (kind == 'C' || kind == 'I'))
+        {
+            if ((kind == 'C' ? OP_CPU : OP_IO) != expect)
+            {
+                fprintf(stderr, "%s:%zu: ops must alternate C<n> I<n> ..., "
+                        "starting with C\n", path, line_no);
+                return -1;
+            }
+            if (depth > 0 && first[depth-1] == OP_TERMINATE)
+            {
+                unsigned int d;
+
+                /* the first burst of a group is the first of the groups
+                   it opens too */
+                for (d=0; d<depth; d++)
+                    if (first[d] == OP_TERMINATE)
+                        first[d] = expect;
+            }
+            emit(insns, count, cap, (insn_kind)expect, time);
+            expect = expect == OP_CPU ? OP_IO : OP_CPU;
+            p += n;
+        }
+        else
+            break;
+    }
+
+    p += strspn(p, " \t\r\n");
+    if (*p != '\0')
+    {
+        fprintf(stderr, "%s:%zu: bad op \"%s\"\n", path, line_no, p);
+        return -1;
+    }
+    if (depth > 0)
+    {
+        fprintf(stderr, "%s:%zu: unclosed \"(\"\n", path, line_no);
+        return -1;
+    }
+    if (*count == start || expect != OP_IO)
+    {
+        fprintf(stderr, "%s:%zu: ops must start and end with a CPU burst\n",
+                path, line_no);
+        return -1;
+    }
+    emit(insns, count, cap, INSN_END, 0);
+    return 0;
+}
+
+extern int workload_load(const char *path)
+{
+    FILE *file;
+    char *line = NULL;
+    size_t line_cap = 0, line_no = 0;
+    size_t count = 0, proc_cap = 0, insn_count = 0, insn_cap = 0;
+    insn_t *insns = NULL;
+    unsigned int loops = 0;
+    op_t *ops = NULL;
+    size_t *first_op = NULL;
+    size_t bare_line = 0, ops_line = 0;     /* first line without / with ops */
+    int streamed = 0;
+    unsigned int *priorities = NULL, *arrivals = NULL;
+    unsigned int *periods = NULL, *deadlines = NULL, *groups = NULL;
+    char **names = NULL;
+    pcb_t *table;
+    size_t i;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    while (getline(&line, &line_cap, file) != -1)
+    {
+        char name[64], *p = line;
+        unsigned int priority, arrival, time;
+        char kind;
+        int n;
+
+        line_no++;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+
+        /* the rest of the file is streamed */
+        if (strncmp(p, "ops:", 4) == 0 && p[4 + strspn(p + 4, " \t\r\n")] == '\0')
+        {
+            streamed = 1;
+            break;
+        }
+
+        if (sscanf(p, "%63s %u %u%n", name, &priority, &arrival, &n) != 3 ||
+            priority > 10)
+        {
+            fprintf(stderr, "%s:%zu: expected \"name priority arrival ops\"\n",
+                    path, line_no);
+            goto error;
+        }
+        p += n;
+
+        first_op = reserve(first_op, &proc_cap, count + 1, sizeof(size_t));
+        priorities = realloc(priorities, proc_cap * sizeof(unsigned int));
+        arrivals = realloc(arrivals, proc_cap * sizeof(unsigned int));
+        names = realloc(names, proc_cap * sizeof(char*));
+        periods = realloc(periods, proc_cap * sizeof(unsigned int));
+        deadlines = realloc(deadlines, proc_cap * sizeof(unsigned int));
+        groups = realloc(groups, proc_cap * sizeof(unsigned int));
+        assert(priorities != NULL && arrivals != NULL && names != NULL &&
+               periods != NULL && deadlines != NULL && groups != NULL);
+        priorities[count] = priority;
+        arrivals[count] = arrival;
+        names[count] = strdup(name);
+        periods[count] = deadlines[count] = groups[count] = 0;
+
+        /* optional real-time constraints P<period> D<deadline>, and G<group> */
+        while (sscanf(p, " %c%u%n", &kind, &time, &n) == 2 &&
+               (kind == 'P' || kind == 'D' || kind == 'G'))
+        {
+            if (kind == 'P')
+                periods[count] = time;
+            else if (kind == 'D')
+                deadlines[count] = time;
+            else
+                groups[count] = time;
+            p += n;
+        }
+
+        first_op[count] = insn_count;
+        p += strspn(p, " \t\r\n");
+        if (*p == '\0')
+        {
+            if (bare_line == 0)
+                bare_line = line_no;
+        }
+        else
+        {
+            if (ops_line == 0)
+                ops_line = line_no;
+            if (parse_program(p, path, line_no, &insns, &insn_count,
+                              &insn_cap, &loops) != 0)
+                goto error;
+        }
+        count++;
+    }
+    free(line);
+
+    if (count == 0)
+    {
+        fprintf(stderr, "%s: no processes\n", path);
+        fclose(file);
+        return -1;
+    }
+    if (streamed && ops_line != 0)
+    {
+        fprintf(stderr, "%s:%zu: a process in a streamed file can't have ops "
+                "before \"ops:\"\n", path, ops_line);
+        fclose(file);
+        return -1;
+    }
+    if (!streamed && bare_line != 0)
+    {
+        fprintf(stderr, "%s:%zu: ops must start and end with a CPU burst\n",
+                path, bare_line);
+        fclose(file);
+        return -1;
+    }
+
+    /* a streamed file's ops are read as its processes run */
+    if (streamed)
+    {
+        stream_file = file;
+        stream_path = strdup(path);
+        stream_line_no = line_no;
+        streams = malloc(sizeof(stream_t) * count);
+        assert(streams != NULL);
+        for (i=0; i<count; i++)
+        {
+            streams[i].queue = NULL;
+            streams[i].head = streams[i].count = streams[i].cap = 0;
+            streams[i].expect = OP_CPU;
+        }
+    }
+    else
+        fclose(file);
+
+    /*
+     * Without repeat groups the program is a plain op array, which pcs can
+     * point into now that it is final.  With them, each process gets a
+     * cursor.
+     */
+    if (loops > 0)
+    {
+        cursors = malloc(sizeof(cursor_t) * count);
+        assert(cursors != NULL);
+    }
+    else if (!streamed)
+    {
+        ops = malloc(sizeof(op_t) * insn_count);
+        assert(ops != NULL);
+        for (i=0; i<insn_count; i++)
+        {
+            ops[i].type = (op_type)insns[i].kind;
+            ops[i].time = insns[i].arg;
+        }
+        free(insns);
+    }
+
+    table = malloc(sizeof(pcb_t) * count);
+    assert(table != NULL);
+    for (i=0; i<count; i++)
+    {
+        op_t *pc;
+
+        if (loops > 0)
+        {
+            cursors[i].ip = &insns[first_op[i]];
+            cursors[i].depth = 0;
+            pc = program_step(&cursors[i]);
+        }
+        else if (!streamed)
+            pc = &ops[first_op[i]];
+        else
+            pc = NULL;      /* until it is created */
+        workload_init_pcb(&table[i], i, names[i], priorities[i], pc);
+        table[i].period = periods[i];
+        table[i].deadline = deadlines[i];
+        table[i].group = groups[i];
+    }
+
+    workload_install(table, count, arrivals, streamed ? next_streamed_op :
+                     loops == 0 ? NULL : next_program_op);
+    free(first_op);
+    free(priorities);
+    free(names);
+    free(periods);
+    free(deadlines);
+    free(groups);
+    return 0;
+
+error:
+    free(line);
+    fclose(file);
+    free(insns);
+    return -1;
+}
+
+extern void workload_replicate(unsigned int count)
+{
+    pcb_t *table;
+    unsigned int i;
+
+    assert(count > 0);
+    table = malloc(sizeof(pcb_t) * count);
+    assert(table != NULL);
+
+    for (i=0; i<count; i++)
+    {
+        pcb_t *tmpl = &processes[i % PROCESS_COUNT];
+        workload_init_pcb(&table[i], i, tmpl->name, tmpl->static_priority,
+                          tmpl->pc);
+    }
+
+    workload_install(table, count, NULL, NULL);
+}
+
+extern op_t *workload_start(pcb_t *pcb)
+{
+    if (pcb->pc == NULL)
+        return workload_next_op(pcb);
+    return pcb->pc;
+}
+
+extern op_t *workload_next_op(pcb_t *pcb)
+{
+    if (next_op != NULL)
+        return next_op(pcb);
+
+    pcb->pc = pcb->pc + 1;
+    return pcb->pc;
+}
+
+extern unsigned int workload_arrival(unsigned int index)
+{
+    if (arrival_times != NULL)
+        return arrival_times[index];
+    return index * 10;
+}
@@ -0,0 +1,114 @@
+/*
+ * workload.h
+ * Multithreaded OS Simulation
+ *
+ * The set of processes the simulator runs.  By default this is the
+ * hard-coded processes[] table from proc.c; larger workloads can be
+ * installed before start_simulator() is called.
+ *
+ * The op arrays a pcb's pc points into are treated as read-only programs:
+ * the simulator tracks the remaining time of the current burst itself, so
+ * many processes may share one op array.  The simulator never steps pc
+ * itself; it asks workload_next_op(), so a workload may also produce its
+ * ops on demand instead of keeping whole arrays in memory.
+ */
+
+#ifndef __WORKLOAD_H__
+#define __WORKLOAD_H__
+
+#include "simOS.h"
+
+/* the processes being simulated, and how many there are */
+extern pcb_t *process_table;
+extern unsigned int process_count;
+
+/*
+ * moves pcb->pc to the process's next op and returns it.  A workload that
+ * produces its ops on demand may leave pc NULL until the process is
+ * created; it is then called for the first op.
+ */
+typedef op_t *(*next_op_fn)(pcb_t *pcb);
+
+/*
+ * workload_install() replaces the process table.
+ *
+ *   arrivals : tick at which each process is created, in any order.
+ *              NULL means one process every 10 ticks in table order.
+ *   next_op  : how processes advance, NULL for plain op arrays (pc + 1).
+ */
+extern void workload_install(pcb_t *table, unsigned int count,
+                             unsigned int *arrivals, next_op_fn next_op);
+
+/* workload_set_arrivals() replaces just the arrival times */
+extern void workload_set_arrivals(unsigned int *arrivals);
+
+/*
+ * workload_load() reads a workload file, one process per line:
+ *
+ *     # name   priority  arrival  ops
+ *     Iapache  8         0        C2 I2 C3 I5 C1
+ *     Iaudio   9         0        P20 D10 C2 I15 C2 I15 C2
+ *     Csolve.0 5         0        G1 C8 I1 C8
+ *     Csolve.1 5         0        G1 C6 I2 C9
+ *
+ * Ops are CPU (C<ticks>) and I/O (I<ticks>) bursts, which must alternate
+ * and start and end with a CPU burst.  They may be preceded by a period
+ * (P<ticks>) and/or relative deadline (D<ticks>), and by a group number
+ * (G<n>) shared by the threads of one process, see pcb_t.  Blank lines and
+ * lines starting with # are ignored.
+ *
+ * (ops)x<n> repeats ops n times, and groups nest up to 8 deep, so
+ * "C2 (I15 C2)x13" is 27 bursts.  A repeated group must start with the
+ * other kind of burst from the one it ends with.  Such programs are kept
+ * compiled, not expanded, so a process costs the same however many bursts
+ * it runs.
+ *
+ * A file may also stream its ops, for traces too long to load.  Its
+ * process lines have no ops, and are followed by a line "ops:" and then
+ * op records, each a process's index (0 for the first process line) and
+ * some of its bursts, with X after its last one:
+ *
+ *     Iapache  8         0
+ *     Cgcc     1         4
+ *     ops:
+ *     0 C2 I2
+ *     1 C12 I1
+ *     0 C3 X
+ *     1 C14 X
+ *
+ * The records are read as the processes need their next op, so with
+ * records in roughly time order only a few ops per live process are in
+ * memory.  A malformed record ends the run when it is reached.
+ *
+ * Returns 0 on success, -1 (after printing a message) if the file can't be
+ * read or is malformed.
+ */
+extern int workload_load(const char *path);
+
+/*
+ * workload_replicate() replaces the process table with count processes
+ * cloned round-robin from the built-in processes[] table (sharing their op
+ * arrays).  Used by the benchmarks to scale the standard workload.
+ */
+extern void workload_replicate(unsigned int count);
+
+/* advance a process to its next op, returns the new pcb->pc */
+extern op_t *workload_next_op(pcb_t *pcb);
+
+/* a newly created process's first op, fetched now if it isn't yet */
+extern op_t *workload_start(pcb_t *pcb);
+
+/* creation time, in ticks, of process_table[index] */
+extern unsigned int workload_arrival(unsigned int index);
+
+/*
+ * workload_init_pcb() fills in a pcb in a malloc'd table.  pcb_t has const
+ * members, so it can't simply be assigned.
+ */
+extern void workload_init_pcb(pcb_t *slot, unsigned int pid, const char *name,
+                              unsigned int priority, op_t *ops);
+
+/* index of a pcb in process_table */
+#define process_index(pcb) ((unsigned int)((pcb) - process_table))
+
+#endif /* __WORKLOAD_H__ */